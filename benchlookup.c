@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "index.h"
+#include "table.h"
+#include "defines.h"
+
+#define BENCH_SEARCHES_COUNT 5
+#define DEFAULT_QUERIES_COUNT (1 << 22)
+
+typedef struct {
+    const char* name;
+    uint32_t flags;
+    int directory;
+} BenchSearch;
+
+double getTime()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+uint64_t nextRandom(uint64_t* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+// Finds the position of hash prefixes with every search of the lookups, half of them taken from the index and half of
+// them random, and prints the timings
+int main(int argc, char **argv)
+{
+    const BenchSearch searches[BENCH_SEARCHES_COUNT] = {
+            {"binary", TABLE_BINARY_SEARCH, 0},
+            {"interpolation", 0, 0},
+            {"directory+binary", TABLE_BINARY_SEARCH, 1},
+            {"directory+interpolation", 0, 1},
+            {"btree", TABLE_BTREE, 0}
+    };
+    IndexTable table;
+    uint64_t* directory;
+    uint64_t queriesCount = DEFAULT_QUERIES_COUNT, randomState = 0x9E3779B97F4A7C15, key, passed, i;
+    uint8_t* queries;
+    int64_t* positions, position;
+    double start, elapsed;
+    int s, j, mismatch;
+
+    if((argc != 2) && ((argc != 4) || (strcmp(argv[2], "--queries") != 0)))
+    {
+        printf("Usage: %s <index_file> [--queries <count>]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if(argc == 4)
+    {
+        queriesCount = strtoull(argv[3], NULL, 10);
+    }
+
+    if(openIndexTable(argv[1], &table) == 1)
+    {
+        printf("Unable to open the index file.\n");
+        return EXIT_FAILURE;
+    }
+
+    // The hash function is not needed to search the entries
+    if((table.indexesCount == 0) || loadIndexTable(&table, TABLE_BTREE))
+    {
+        printf("Unable to load the index.\n");
+
+        closeIndexTable(&table);
+        return EXIT_FAILURE;
+    }
+
+    queries = malloc(queriesCount * INDEX_HASH_SIZE);
+    positions = malloc(queriesCount * sizeof(int64_t));
+
+    if((queries == NULL) || (positions == NULL))
+    {
+        printf("Unable to allocate the queries.\n");
+
+        free(queries);
+        free(positions);
+        closeIndexTable(&table);
+        return EXIT_FAILURE;
+    }
+
+    for(i=0 ; i<queriesCount ; i++)
+    {
+        key = nextRandom(&randomState);
+
+        if(i % 2)
+        {
+            memcpy(queries + i * INDEX_HASH_SIZE, table.index + (key % table.indexesCount) * table.indexEntrySize,
+                   INDEX_HASH_SIZE);
+        }
+        else
+        {
+            for(j=0 ; j<INDEX_HASH_SIZE ; j++)
+            {
+                queries[i * INDEX_HASH_SIZE + j] = key >> (j << 3);
+            }
+        }
+    }
+
+    directory = table.directory;
+
+    printf("%lu entries of %u bytes, %lu queries (half of them hits)\n", table.indexesCount, table.indexEntrySize,
+           queriesCount);
+
+    for(s=0 ; s<BENCH_SEARCHES_COUNT ; s++)
+    {
+        if(searches[s].directory && (directory == NULL))
+        {
+            printf("%-24s no directory in this index\n", searches[s].name);
+            continue;
+        }
+
+        table.flags = searches[s].flags;
+        table.directory = searches[s].directory ? directory : NULL;
+        mismatch = 0;
+
+        start = getTime();
+
+        for(i=0 ; i<queriesCount ; i++)
+        {
+            position = findFirstEntry(&table, queries + i * INDEX_HASH_SIZE);
+
+            if(s == 0)
+            {
+                positions[i] = position;
+            }
+            else if(positions[i] != position)
+            {
+                mismatch = 1;
+            }
+        }
+
+        elapsed = getTime() - start;
+
+        printf("%-24s %10.3f s %10.1f ns/lookup%s\n", searches[s].name, elapsed, elapsed / queriesCount * 1e9,
+               mismatch ? " MISMATCH" : "");
+    }
+
+    table.directory = directory;
+
+    // The random queries are misses, those the filter lets through are its false positives. It must let every hit through.
+    if(table.filter.blocks != NULL)
+    {
+        passed = 0;
+        mismatch = 0;
+
+        start = getTime();
+
+        for(i=0 ; i<queriesCount ; i++)
+        {
+            if(mayContainKey(&table.filter, getEntryKey(queries + i * INDEX_HASH_SIZE)))
+            {
+                passed += !(i % 2);
+            }
+            else if(i % 2)
+            {
+                mismatch = 1;
+            }
+        }
+
+        elapsed = getTime() - start;
+
+        printf("%-24s %10.3f s %10.1f ns/check %8.4f%% false positives%s\n", "filter", elapsed,
+               elapsed / queriesCount * 1e9, 100.0 * passed / ((queriesCount + 1) / 2), mismatch ? " MISMATCH" : "");
+    }
+
+    free(queries);
+    free(positions);
+    closeIndexTable(&table);
+
+    return EXIT_SUCCESS;
+}
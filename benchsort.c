@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "index.h"
+#include "sorting.h"
+#include "defines.h"
+
+#define BENCH_ALGORITHMS_COUNT 3
+
+double getTime()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int isSorted(uint8_t* entries, uint64_t count, uint8_t entrySize)
+{
+    uint64_t i;
+
+    for(i=1 ; i<count ; i++)
+    {
+        if(memcmp(entries + (i - 1) * entrySize, entries + i * entrySize, INDEX_HASH_SIZE) > 0)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Sorts the entries of an index with every algorithm, from the same unsorted copy each time, and prints the timings
+int main(int argc, char **argv)
+{
+    const char* names[BENCH_ALGORITHMS_COUNT] = {"merge", "radix", "inplace"};
+    FILE* indexFile;
+    IndexHeader indexHeader;
+    SortAlgorithm algorithm;
+    uint64_t entriesCount, bufSize;
+    uint8_t* entries, *sortBuffer, *workBuffer;
+    uint8_t indexEntrySize;
+    uint32_t threadsCount = 1;
+    double start, elapsed;
+    int i, error = 0;
+
+    if((argc != 2) && ((argc != 4) || (strcmp(argv[2], "--threads") != 0)))
+    {
+        printf("Usage: %s <index_file> [--threads <count>]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if(argc == 4)
+    {
+        threadsCount = strtol(argv[3], NULL, 10);
+    }
+
+    indexFile = fopen(argv[1], "r");
+
+    if(indexFile == NULL)
+    {
+        printf("Unable to open the index file.\n");
+        return EXIT_FAILURE;
+    }
+
+    if(readIndexHeader(indexFile, &indexHeader))
+    {
+        printf("Invalid index file.\n");
+
+        fclose(indexFile);
+        return EXIT_FAILURE;
+    }
+
+    indexEntrySize = getIndexEntrySize(&indexHeader);
+    entriesCount = getIndexesCount(&indexHeader);
+    bufSize = indexEntrySize * entriesCount;
+
+    entries = malloc(bufSize);
+    sortBuffer = malloc(bufSize);
+    workBuffer = malloc(bufSize);
+
+    if((entries == NULL) || (sortBuffer == NULL) || (workBuffer == NULL))
+    {
+        printf("Unable to allocate the sort buffers.\n");
+
+        free(entries);
+        free(sortBuffer);
+        free(workBuffer);
+        fclose(indexFile);
+        return EXIT_FAILURE;
+    }
+
+    fseek(indexFile, getIndexEntriesOffset(&indexHeader), SEEK_SET);
+
+    if(fread(entries, indexEntrySize, entriesCount, indexFile) != entriesCount)
+    {
+        printf("Unable to read the index entries.\n");
+        error = 1;
+    }
+
+    fclose(indexFile);
+
+    printf("%lu entries of %u bytes, %u thread(s)\n", entriesCount, indexEntrySize, threadsCount);
+
+    for(i=0 ; (i<BENCH_ALGORITHMS_COUNT) && !error ; i++)
+    {
+        getSortAlgorithm(names[i], &algorithm);
+        memcpy(sortBuffer, entries, bufSize);
+
+        start = getTime();
+        sortIndexEntriesParallel(sortBuffer, workBuffer, entriesCount, indexEntrySize, algorithm, threadsCount);
+        elapsed = getTime() - start;
+
+        printf("%-8s %10.3f s %10.2f M entries/s%s\n", names[i], elapsed, entriesCount / elapsed / 1e6,
+               isSorted(sortBuffer, entriesCount, indexEntrySize) ? "" : " NOT SORTED");
+    }
+
+    free(entries);
+    free(sortBuffer);
+    free(workBuffer);
+
+    return error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -2,12 +2,82 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "utils.h"
 #include "index.h"
 #include "hash.h"
+#include "sorting.h"
+#include "merging.h"
+#include "filter.h"
 #include "defines.h"
 
+#define BATCH_WORDS 16384
+#define BATCH_TEXT_SIZE MIB
+
+#define DEFAULT_SORT_MEMORY (1024 * (uint64_t) MIB)
+
+typedef struct {
+    uint8_t hash[INDEX_HASH_SIZE];
+    WordType wordType;
+    uint32_t compressedBitsSize;
+    const uint8_t* data;
+} EncodedWord;
+
+typedef struct {
+    HashInfos hashInfos;
+    size_t indexDataBits;
+    size_t indexDataBytes;
+    EntryWriter entries;
+    FILE* tmpFile;
+    uint64_t tmpOffset;
+    int sorted;
+    int sortError;
+    uint8_t* sortWork;
+    char* runsPath;
+    FILE* runsFile;
+    uint64_t* runCounts;
+    uint32_t runsCount;
+} BuildParameters;
+
+typedef enum {
+    BATCH_FREE = 0,
+    BATCH_READ = 1,
+    BATCH_ENCODED = 2
+} BatchState;
+
+// A batch of consecutive words. The words point into the mapped wordlist, or into text when the wordlist is streamed.
+// Each word owns lengths[i] + 1 bytes at offsets[i] in text and compressed: its compressed form is written there
+// (a compressed word is never larger than the word plus its NUL).
+typedef struct {
+    BatchState state;
+    uint64_t sequence;
+    uint64_t wordlistOffset;
+    uint32_t count;
+    size_t textSize;
+    char* text;
+    uint8_t* compressed;
+    const char** words;
+    uint32_t* offsets;
+    size_t* lengths;
+    EncodedWord* encodedWords;
+} WordBatch;
+
+typedef struct {
+    BuildParameters* params;
+    WordlistReader* wordlist;
+    WordBatch* batches;
+    uint32_t batchesCount;
+    uint64_t readSequence;
+    uint64_t encodeSequence;
+    int finished;
+    int error;
+    pthread_mutex_t lock;
+    pthread_cond_t batchRead;
+    pthread_cond_t batchEncoded;
+    pthread_cond_t batchFreed;
+} Pipeline;
+
 void showProgress(uint64_t offset, uint64_t maxOffset, uint64_t hashesGenerated)
 {
     float percents = (float) offset / (float) maxOffset * 100;
@@ -15,158 +85,683 @@ void showProgress(uint64_t offset, uint64_t maxOffset, uint64_t hashesGenerated)
     printf("\033[A\r\33[2K%lu / %lu (%.2f%%) - %lu hashes generated\n", offset, maxOffset, percents, hashesGenerated);
 }
 
-int main(int argc, char** argv)
+void encodeWord(const char* line, size_t lineLength, uint8_t* compressedLine, EncodedWord* out)
 {
-    HashInfos hashInfos;
-    FILE* wordlistFile = NULL, *outputFile = NULL, *tmpFile = NULL;
-    uint8_t* digest = NULL;
-    uint8_t* copyBuffer = malloc(MIB);
-    char line[MAX_LINE_SIZE] = {0};
-    uint8_t compressedLine[MAX_LINE_SIZE] = {0};
-    char* tmp;
-    size_t lineLength, indexDataBits, indexDataBytes;
-    uint64_t wordlistFileSize, offset, i = 0;
-    uint32_t readSize;
-    uint64_t wordlistOffset;
-    WordType wordType;
-    uint32_t compressedBitsSize;
+    out->data = compressedLine;
+
+    if(isNumeric(line, lineLength))
+    {
+        compressNumeric(line, lineLength, compressedLine);
+        out->wordType = NUMERIC;
+        out->compressedBitsSize = NUMERIC_COMPRESSED_BITS(lineLength) + NUMERIC_SYMBOL_BITS;
+    }
+    else if(isAlphanumeric(line, lineLength))
+    {
+        compressAlphanumeric(line, lineLength, compressedLine);
+        out->wordType = ALPHANUMERIC;
+        out->compressedBitsSize = ALPHANUMERIC_COMPRESSED_BITS(lineLength) + ALPHANUMERIC_SYMBOL_BITS;
+    }
+    else if(isReducedASCII(line, lineLength))
+    {
+        compressReducedASCII(line, lineLength, compressedLine);
+        out->wordType = REDUCED_ASCII;
+        out->compressedBitsSize = REDUCED_ASCII_COMPRESSED_BITS(lineLength) + REDUCED_ASCII_SYMBOL_BITS;
+    }
+    else
+    {
+        out->wordType = NO_COMPRESSION;
+        out->compressedBitsSize = (lineLength + 1) << 3;
+
+        memcpy(compressedLine, line, lineLength);
+        compressedLine[lineLength] = '\0';
+    }
+}
 
-    hashInfos.f = NULL;
+// The words are hashed HASH_BATCH_SIZE at a time so the multi-buffer hash kernels can fill their lanes.
+void encodeBatch(BuildParameters* params, WordBatch* batch)
+{
+    const unsigned char* words[HASH_BATCH_SIZE];
+    size_t lengths[HASH_BATCH_SIZE];
+    uint8_t digests[HASH_BATCH_SIZE * MAX_DIGEST_SIZE];
+    uint32_t i, j, count;
 
-    if(argc != 6)
+    for(i=0 ; i<batch->count ; i+=count)
     {
-        printf("Usage: %s <hash_function> <index_data_bits> <wordlist_file> <output_file> <tmp_file>\n", argv[0]);
-        return EXIT_FAILURE;
+        count = (batch->count - i < HASH_BATCH_SIZE) ? batch->count - i : HASH_BATCH_SIZE;
+
+        for(j=0 ; j<count ; j++)
+        {
+            words[j] = (unsigned char*) batch->words[i + j];
+            lengths[j] = batch->lengths[i + j];
+        }
+
+        params->hashInfos.batch(words, lengths, count, digests);
+
+        for(j=0 ; j<count ; j++)
+        {
+            memcpy(batch->encodedWords[i + j].hash, digests + j * params->hashInfos.digestSize, INDEX_HASH_SIZE);
+            encodeWord(batch->words[i + j], lengths[j], batch->compressed + batch->offsets[i + j],
+                       &batch->encodedWords[i + j]);
+        }
     }
+}
 
-    getHashInfos(argv[1], &hashInfos);
+// Sorts the entries held in the run buffer and appends them to the runs file.
+int spillRun(BuildParameters* params)
+{
+    uint8_t entrySize = INDEX_HASH_SIZE + params->indexDataBytes;
+    uint64_t* runCounts;
 
-    if(hashInfos.f == NULL)
+    if(params->runsFile == NULL)
     {
-        printf("Hash name %s is not recognized. Supported hashes are: md5, sha1, sha256.\n", argv[1]);
-        return EXIT_FAILURE;
+        params->runsFile = fopen(params->runsPath, "w+");
+
+        if(params->runsFile == NULL)
+        {
+            return 1;
+        }
     }
 
-    wordlistFile = fopen(argv[3], "r");
+    runCounts = realloc(params->runCounts, (params->runsCount + 1) * sizeof(uint64_t));
 
-    if(wordlistFile == NULL)
+    if(runCounts == NULL)
     {
-        printf("Unable to open the wordlist file.\n");
-        return EXIT_FAILURE;
+        return 1;
     }
 
-    outputFile = fopen(argv[4], "w");
+    params->runCounts = runCounts;
+    params->runCounts[params->runsCount++] = params->entries.used / entrySize;
 
-    if(outputFile == NULL)
+    sortIndexEntries(params->entries.buffer, params->sortWork, params->entries.used / entrySize, entrySize, SORT_RADIX);
+
+    if(fwrite(params->entries.buffer, params->entries.used, 1, params->runsFile) != 1)
     {
-        printf("Unable to open the output file.\n");
-        return EXIT_FAILURE;
+        return 1;
     }
 
-    tmpFile = fopen(argv[5], "w+");
+    params->entries.used = 0;
 
-    if(tmpFile == NULL)
+    return 0;
+}
+
+// Writes the sorted entries after the header: a single run is sorted in memory, otherwise the runs are merged from the
+// runs file. The run buffer and the sort work buffer are reused as the merge buffers.
+int writeSortedEntries(BuildParameters* params, FILE* outputFile)
+{
+    uint8_t entrySize = INDEX_HASH_SIZE + params->indexDataBytes;
+    size_t runSize = params->entries.size, streamBufferSize;
+    uint64_t offset = 0;
+    EntryStream* streams;
+    EntryMerger merger;
+    EntryWriter output;
+    uint8_t* entry;
+    uint32_t i;
+    int error = 0;
+
+    if(params->runsCount == 0)
     {
-        printf("Unable to open the temporary file.\n");
-        return EXIT_FAILURE;
+        sortIndexEntries(params->entries.buffer, params->sortWork, params->entries.used / entrySize, entrySize, SORT_RADIX);
+
+        return (params->entries.used != 0) && (fwrite(params->entries.buffer, params->entries.used, 1, outputFile) != 1);
     }
 
-    wordlistFileSize = getFileSize(wordlistFile);
-    indexDataBits = strtol(argv[2], NULL, 10);
-    indexDataBytes = BYTES_SIZE(indexDataBits);
+    if(spillRun(params) || fflush(params->runsFile))
+    {
+        return 1;
+    }
+
+    streamBufferSize = runSize / params->runsCount;
+    streams = malloc(params->runsCount * sizeof(EntryStream));
 
-    if(!isDataSizeValid(wordlistFile, indexDataBits))
+    if((streams == NULL) || (streamBufferSize < entrySize))
     {
-        printf("Invalid data size.\n");
-        return EXIT_FAILURE;
+        free(streams);
+        return 1;
     }
 
-    digest = malloc(hashInfos.digestSize);
+    for(i=0 ; i<params->runsCount ; i++)
+    {
+        openEntryStream(&streams[i], fileno(params->runsFile), offset, params->runCounts[i], entrySize,
+                        params->sortWork + i * streamBufferSize, streamBufferSize);
+
+        offset += params->runCounts[i] * entrySize;
+    }
+
+    if(initEntryMerger(&merger, streams, params->runsCount))
+    {
+        free(streams);
+        return 1;
+    }
+
+    initEntryWriter(&output, params->entries.buffer, runSize, outputFile);
+
+    while((entry = nextMergedEntry(&merger, NULL)) != NULL)
+    {
+        writeIndexEntry(entry, entrySize, &output);
+    }
 
-    // This header is only a placeholder for now
-    writeIndexHeader(outputFile, argv[1], indexDataBytes, 0);
+    error = flushEntryWriter(&output);
 
-    while(fgets(line, MAX_LINE_SIZE, wordlistFile) != NULL)
+    freeEntryMerger(&merger);
+    free(streams);
+
+    return error;
+}
+
+void writeWord(BuildParameters* params, EncodedWord* word)
+{
+    size_t wordBytes;
+
+    if(params->sorted && (params->entries.used + INDEX_HASH_SIZE + params->indexDataBytes > params->entries.size))
+    {
+        params->sortError |= spillRun(params);
+    }
+
+    if(word->compressedBitsSize + 3 <= params->indexDataBits)
+    {
+        writeIndexEntryInline(word->hash, word->data, word->compressedBitsSize, params->indexDataBytes, word->wordType,
+                              &params->entries);
+    }
+    else
     {
-        tmp = memchr(line, '\r', MAX_LINE_SIZE);
+        wordBytes = BYTES_SIZE(word->compressedBitsSize);
+
+        writeIndexEntryPointer(word->hash, params->tmpOffset, params->indexDataBytes, word->wordType, &params->entries);
+        fwrite(word->data, sizeof(uint8_t), wordBytes, params->tmpFile);
+
+        params->tmpOffset += wordBytes;
+    }
+}
 
-        if(tmp == NULL)
+// Fills the batch with the next words of the wordlist. Returns the last nextWord result: 0 once the wordlist is
+// exhausted, -1 if a line is too long.
+int readBatch(WordlistReader* wordlist, WordBatch* batch)
+{
+    const char* word;
+    size_t wordLength;
+    int ret = 1;
+
+    batch->count = 0;
+    batch->textSize = 0;
+
+    while((batch->count < BATCH_WORDS) && (batch->textSize + MAX_LINE_SIZE <= BATCH_TEXT_SIZE)
+          && ((ret = nextWord(wordlist, &word, &wordLength)) > 0))
+    {
+        // A streamed word is only valid until the next read
+        if(!wordlist->mapped)
         {
-            tmp = memchr(line, '\n', MAX_LINE_SIZE);
+            memcpy(batch->text + batch->textSize, word, wordLength);
+            word = batch->text + batch->textSize;
         }
 
-        if(tmp == NULL)
+        batch->words[batch->count] = word;
+        batch->offsets[batch->count] = batch->textSize;
+        batch->lengths[batch->count] = wordLength;
+        batch->textSize += wordLength + 1;
+        batch->count++;
+    }
+
+    batch->wordlistOffset = getWordlistOffset(wordlist);
+
+    return ret;
+}
+
+void writeBatch(BuildParameters* params, WordBatch* batch, uint64_t wordlistFileSize, uint64_t* hashesGenerated)
+{
+    uint32_t i;
+
+    for(i=0 ; i<batch->count ; i++)
+    {
+        writeWord(params, &batch->encodedWords[i]);
+        (*hashesGenerated)++;
+
+        if((*hashesGenerated % PROGRESS_UPDATE_COUNT) == 0)
         {
-            printf("Error: the line is too long (larger than %u characters).\n", MAX_LINE_SIZE - 1);
-            return EXIT_FAILURE;
+            showProgress(batch->wordlistOffset, wordlistFileSize, *hashesGenerated);
         }
+    }
+}
 
-        *tmp = '\0';
-        lineLength = tmp - line;
+void* readerThread(void* arg)
+{
+    Pipeline* pipeline = arg;
+    uint64_t sequence;
+    WordBatch* batch;
+    int ret = 1;
 
-        hashInfos.f((uint8_t*) line, lineLength, digest);
+    for(sequence=0 ; ret > 0 ; sequence++)
+    {
+        batch = &pipeline->batches[sequence % pipeline->batchesCount];
 
-        if(isNumeric(line))
+        pthread_mutex_lock(&pipeline->lock);
+
+        while(batch->state != BATCH_FREE)
         {
-            compressNumeric(line, lineLength, compressedLine);
-            wordType = NUMERIC;
-            compressedBitsSize = NUMERIC_COMPRESSED_BITS(lineLength) + NUMERIC_SYMBOL_BITS;
+            pthread_cond_wait(&pipeline->batchFreed, &pipeline->lock);
         }
-        else if(isAlphanumeric(line))
+
+        pthread_mutex_unlock(&pipeline->lock);
+
+        ret = readBatch(pipeline->wordlist, batch);
+
+        pthread_mutex_lock(&pipeline->lock);
+
+        if(batch->count != 0)
         {
-            compressAlphanumeric(line, lineLength, compressedLine);
-            wordType = ALPHANUMERIC;
-            compressedBitsSize = ALPHANUMERIC_COMPRESSED_BITS(lineLength) + ALPHANUMERIC_SYMBOL_BITS;
+            batch->sequence = sequence;
+            batch->state = BATCH_READ;
+            pipeline->readSequence = sequence + 1;
+
+            pthread_cond_broadcast(&pipeline->batchRead);
         }
-        else if(isReducedASCII(line))
+
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+
+    pthread_mutex_lock(&pipeline->lock);
+
+    pipeline->error = ret < 0;
+    pipeline->finished = 1;
+
+    pthread_cond_broadcast(&pipeline->batchRead);
+    pthread_cond_broadcast(&pipeline->batchEncoded);
+    pthread_mutex_unlock(&pipeline->lock);
+
+    return NULL;
+}
+
+void* encoderThread(void* arg)
+{
+    Pipeline* pipeline = arg;
+    WordBatch* batch;
+
+    while(1)
+    {
+        pthread_mutex_lock(&pipeline->lock);
+
+        while((pipeline->encodeSequence == pipeline->readSequence) && !pipeline->finished)
         {
-            compressReducedASCII(line, lineLength, compressedLine);
-            wordType = REDUCED_ASCII;
-            compressedBitsSize = REDUCED_ASCII_COMPRESSED_BITS(lineLength) + REDUCED_ASCII_SYMBOL_BITS;
+            pthread_cond_wait(&pipeline->batchRead, &pipeline->lock);
         }
-        else
+
+        if(pipeline->encodeSequence == pipeline->readSequence)
         {
-            wordType = NO_COMPRESSION;
-            compressedBitsSize = (lineLength + 1) << 3;
+            pthread_mutex_unlock(&pipeline->lock);
+            break;
         }
 
-        if(compressedBitsSize + 3 <= indexDataBits)
+        batch = &pipeline->batches[pipeline->encodeSequence % pipeline->batchesCount];
+        pipeline->encodeSequence++;
+
+        pthread_mutex_unlock(&pipeline->lock);
+
+        encodeBatch(pipeline->params, batch);
+
+        pthread_mutex_lock(&pipeline->lock);
+
+        batch->state = BATCH_ENCODED;
+
+        pthread_cond_broadcast(&pipeline->batchEncoded);
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+
+    return NULL;
+}
+
+int allocateBatch(WordBatch* batch)
+{
+    batch->state = BATCH_FREE;
+    batch->text = malloc(BATCH_TEXT_SIZE);
+    batch->compressed = malloc(BATCH_TEXT_SIZE);
+    batch->words = malloc(BATCH_WORDS * sizeof(char*));
+    batch->offsets = malloc(BATCH_WORDS * sizeof(uint32_t));
+    batch->lengths = malloc(BATCH_WORDS * sizeof(size_t));
+    batch->encodedWords = malloc(BATCH_WORDS * sizeof(EncodedWord));
+
+    return (batch->text == NULL) || (batch->compressed == NULL) || (batch->words == NULL) || (batch->offsets == NULL)
+           || (batch->lengths == NULL) || (batch->encodedWords == NULL);
+}
+
+void freeBatch(WordBatch* batch)
+{
+    free(batch->text);
+    free(batch->compressed);
+    free(batch->words);
+    free(batch->offsets);
+    free(batch->lengths);
+    free(batch->encodedWords);
+}
+
+int allocateBatches(Pipeline* pipeline)
+{
+    uint32_t i;
+
+    pipeline->batches = calloc(pipeline->batchesCount, sizeof(WordBatch));
+
+    if(pipeline->batches == NULL)
+    {
+        return 1;
+    }
+
+    for(i=0 ; i<pipeline->batchesCount ; i++)
+    {
+        if(allocateBatch(&pipeline->batches[i]))
         {
-            if(wordType == NO_COMPRESSION)
-            {
-                writeIndexEntryInline(digest, (uint8_t*) line, compressedBitsSize, indexDataBytes, NO_COMPRESSION, outputFile);
-            }
-            else
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void freeBatches(Pipeline* pipeline)
+{
+    uint32_t i;
+
+    if(pipeline->batches == NULL)
+    {
+        return;
+    }
+
+    for(i=0 ; i<pipeline->batchesCount ; i++)
+    {
+        freeBatch(&pipeline->batches[i]);
+    }
+
+    free(pipeline->batches);
+}
+
+// Returns 0 on success, 1 if a line is too long and 2 if the buffers cannot be allocated.
+int buildSequential(BuildParameters* params, WordlistReader* wordlist)
+{
+    WordBatch batch;
+    uint64_t i = 0;
+    int ret = 1;
+
+    if(allocateBatch(&batch))
+    {
+        freeBatch(&batch);
+        return 2;
+    }
+
+    while(ret > 0)
+    {
+        ret = readBatch(wordlist, &batch);
+
+        encodeBatch(params, &batch);
+        writeBatch(params, &batch, wordlist->size, &i);
+    }
+
+    freeBatch(&batch);
+
+    return ret != 0;
+}
+
+// Same as buildSequential, but the wordlist is read by one thread, hashed and compressed by threadsCount threads, and the entries are written in
+// the wordlist order by the calling thread so the index is identical to the one built sequentially.
+int buildParallel(BuildParameters* params, WordlistReader* wordlist, uint32_t threadsCount)
+{
+    Pipeline pipeline;
+    pthread_t reader;
+    pthread_t* encoders;
+    WordBatch* batch;
+    uint64_t sequence, i = 0;
+    uint32_t j;
+    int error = 0;
+
+    memset(&pipeline, 0x00, sizeof(Pipeline));
+
+    pipeline.params = params;
+    pipeline.wordlist = wordlist;
+    pipeline.batchesCount = 2 * threadsCount + 2;
+
+    encoders = malloc(threadsCount * sizeof(pthread_t));
+
+    if((encoders == NULL) || allocateBatches(&pipeline))
+    {
+        free(encoders);
+        freeBatches(&pipeline);
+        return 2;
+    }
+
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.batchRead, NULL);
+    pthread_cond_init(&pipeline.batchEncoded, NULL);
+    pthread_cond_init(&pipeline.batchFreed, NULL);
+
+    pthread_create(&reader, NULL, readerThread, &pipeline);
+
+    for(j=0 ; j<threadsCount ; j++)
+    {
+        pthread_create(&encoders[j], NULL, encoderThread, &pipeline);
+    }
+
+    for(sequence=0 ; ; sequence++)
+    {
+        batch = &pipeline.batches[sequence % pipeline.batchesCount];
+
+        pthread_mutex_lock(&pipeline.lock);
+
+        while(!((batch->state == BATCH_ENCODED) && (batch->sequence == sequence))
+              && !(pipeline.finished && (sequence >= pipeline.readSequence)))
+        {
+            pthread_cond_wait(&pipeline.batchEncoded, &pipeline.lock);
+        }
+
+        pthread_mutex_unlock(&pipeline.lock);
+
+        if((batch->state != BATCH_ENCODED) || (batch->sequence != sequence))
+        {
+            break;
+        }
+
+        writeBatch(params, batch, wordlist->size, &i);
+
+        pthread_mutex_lock(&pipeline.lock);
+
+        batch->state = BATCH_FREE;
+
+        pthread_cond_broadcast(&pipeline.batchFreed);
+        pthread_mutex_unlock(&pipeline.lock);
+    }
+
+    pthread_join(reader, NULL);
+
+    for(j=0 ; j<threadsCount ; j++)
+    {
+        pthread_join(encoders[j], NULL);
+    }
+
+    error = pipeline.error;
+
+    pthread_mutex_destroy(&pipeline.lock);
+    pthread_cond_destroy(&pipeline.batchRead);
+    pthread_cond_destroy(&pipeline.batchEncoded);
+    pthread_cond_destroy(&pipeline.batchFreed);
+
+    freeBatches(&pipeline);
+    free(encoders);
+
+    return error;
+}
+
+int main(int argc, char** argv)
+{
+    BuildParameters params;
+    WordlistReader wordlist;
+    FILE* outputFile = NULL, *tmpFile = NULL;
+    uint8_t* copyBuffer = malloc(MIB);
+    uint8_t* writeBuffer = NULL;
+    uint32_t readSize, threadsCount = 0;
+    uint64_t wordlistOffset, sortMemory = DEFAULT_SORT_MEMORY;
+    size_t writeBufferSize = WRITE_BUFFER_SIZE;
+    FilterHeader filterHeader;
+    double falsePositiveRate = 0;
+    int i, error;
+
+    memset(&params, 0x00, sizeof(BuildParameters));
+
+    if(argc < 6)
+    {
+        printf("Usage: %s <hash_function> <index_data_bits> <wordlist_file> <output_file> <tmp_file> [--threads <count>] [--sorted [--sort-memory <MiB>] [--filter <false_positive_rate>]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for(i=6 ; i<argc ; i++)
+    {
+        if((strcmp(argv[i], "--threads") == 0) && (i + 1 < argc))
+        {
+            threadsCount = strtol(argv[++i], NULL, 10);
+        }
+        else if(strcmp(argv[i], "--sorted") == 0)
+        {
+            params.sorted = 1;
+        }
+        else if((strcmp(argv[i], "--sort-memory") == 0) && (i + 1 < argc))
+        {
+            sortMemory = strtol(argv[++i], NULL, 10) * MIB;
+        }
+        else if((strcmp(argv[i], "--filter") == 0) && (i + 1 < argc))
+        {
+            if(parseFalsePositiveRate(argv[++i], &falsePositiveRate))
             {
-                writeIndexEntryInline(digest, compressedLine, compressedBitsSize, indexDataBytes, wordType, outputFile);
+                printf("The false positive rate must be between 0 and 1: %s\n", argv[i]);
+                return EXIT_FAILURE;
             }
         }
         else
         {
-            writeIndexEntryPointer(digest, ftell(tmpFile), indexDataBytes, wordType, outputFile);
+            printf("Unknown option: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
 
-            if(wordType == NO_COMPRESSION)
-            {
-                fwrite(line, sizeof(char), BYTES_SIZE(compressedBitsSize), tmpFile);
-            }
-            else
-            {
-                fwrite(compressedLine, sizeof(uint8_t), BYTES_SIZE(compressedBitsSize), tmpFile);
-            }
+    // The filter of an unsorted index is written by sort
+    if((falsePositiveRate != 0) && !params.sorted)
+    {
+        printf("The --filter option needs --sorted, the filter of an unsorted index is written by sort.\n");
+        return EXIT_FAILURE;
+    }
+
+    getHashInfos(argv[1], &params.hashInfos);
+
+    if(params.hashInfos.f == NULL)
+    {
+        printf("Hash name %s is not recognized. Supported hashes are: md5, sha1, sha256.\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    if(openWordlist(argv[3], &wordlist))
+    {
+        printf("Unable to open the wordlist file.\n");
+        return EXIT_FAILURE;
+    }
+
+    outputFile = fopen(argv[4], "w+");
+
+    if(outputFile == NULL)
+    {
+        printf("Unable to open the output file.\n");
+        return EXIT_FAILURE;
+    }
+
+    tmpFile = fopen(argv[5], "w+");
+
+    if(tmpFile == NULL)
+    {
+        printf("Unable to open the temporary file.\n");
+        return EXIT_FAILURE;
+    }
+
+    params.indexDataBits = strtol(argv[2], NULL, 10);
+    params.indexDataBytes = BYTES_SIZE(params.indexDataBits);
+    params.tmpFile = tmpFile;
+    params.tmpOffset = 0;
+
+    if(!isDataSizeValid(wordlist.size, params.indexDataBits))
+    {
+        printf("Invalid data size.\n");
+        return EXIT_FAILURE;
+    }
+
+    // When sorting, the entries are collected in runs of half the sort memory, the other half is the sort work buffer
+    if(params.sorted)
+    {
+        writeBufferSize = sortMemory / 2 - (sortMemory / 2) % (INDEX_HASH_SIZE + params.indexDataBytes);
+
+        if(writeBufferSize == 0)
+        {
+            writeBufferSize = INDEX_HASH_SIZE + params.indexDataBytes;
         }
 
-        memset(line, '\0', MAX_LINE_SIZE);
+        params.sortWork = malloc(writeBufferSize);
+        params.runsPath = malloc(strlen(argv[5]) + sizeof(RUNS_FILE_SUFFIX));
 
-        offset = ftell(wordlistFile);
-        i++;
+        if((params.sortWork == NULL) || (params.runsPath == NULL))
+        {
+            printf("Unable to allocate the sort buffers.\n");
+            return EXIT_FAILURE;
+        }
 
-        if((i % PROGRESS_UPDATE_COUNT) == 0)
+        sprintf(params.runsPath, "%s%s", argv[5], RUNS_FILE_SUFFIX);
+    }
+
+    writeBuffer = malloc(writeBufferSize);
+
+    if(writeBuffer == NULL)
+    {
+        printf("Unable to allocate the write buffer.\n");
+        return EXIT_FAILURE;
+    }
+
+    initEntryWriter(&params.entries, writeBuffer, writeBufferSize, params.sorted ? NULL : outputFile);
+
+    // This header and the directory are only placeholders for now
+    writeIndexHeader(outputFile, INDEX_MAGIC_DIRECTORY, argv[1], params.indexDataBytes, 0);
+    reserveIndexDirectory(outputFile);
+
+    if(threadsCount == 0)
+    {
+        error = buildSequential(&params, &wordlist);
+    }
+    else
+    {
+        error = buildParallel(&params, &wordlist, threadsCount);
+    }
+
+    if(error == 2)
+    {
+        printf("Unable to allocate the build buffers.\n");
+        return EXIT_FAILURE;
+    }
+    else if(error)
+    {
+        printf("Error: the line is too long (larger than %u characters).\n", MAX_LINE_SIZE - 1);
+        return EXIT_FAILURE;
+    }
+
+    if(params.sorted)
+    {
+        error = params.sortError || writeSortedEntries(&params, outputFile);
+
+        if(params.runsFile != NULL)
+        {
+            fclose(params.runsFile);
+            unlink(params.runsPath);
+        }
+
+        if(error)
         {
-            showProgress(offset, wordlistFileSize, i);
+            printf("Unable to sort the index entries.\n");
+            return EXIT_FAILURE;
         }
     }
+    else
+    {
+        flushEntryWriter(&params.entries);
+    }
 
-    wordlistOffset = ftell(outputFile) - sizeof(IndexHeader);
+    wordlistOffset = ftell(outputFile) - sizeof(IndexHeader) - INDEX_DIRECTORY_SIZE;
     rewind(tmpFile);
 
     while((readSize = fread(copyBuffer, 1, MIB, tmpFile)) != 0)
@@ -175,16 +770,37 @@ int main(int argc, char** argv)
     }
 
     rewind(outputFile);
-    writeIndexHeader(outputFile, argv[1], indexDataBytes, wordlistOffset);
+    writeIndexHeader(outputFile, INDEX_MAGIC_DIRECTORY, argv[1], params.indexDataBytes, wordlistOffset);
+
+    // An unsorted index gets its directory from sort
+    if(params.sorted && updateIndexDirectory(outputFile))
+    {
+        printf("Unable to write the index directory.\n");
+        return EXIT_FAILURE;
+    }
 
     free(copyBuffer);
-    free(digest);
+    free(writeBuffer);
+    free(params.sortWork);
+    free(params.runsPath);
+    free(params.runCounts);
 
-    fclose(wordlistFile);
+    closeWordlist(&wordlist);
     fclose(outputFile);
     fclose(tmpFile);
 
     unlink(argv[5]);
 
+    if(falsePositiveRate != 0)
+    {
+        if(writeIndexFilter(argv[4], falsePositiveRate, &filterHeader))
+        {
+            printf("Unable to write the index filter.\n");
+            return EXIT_FAILURE;
+        }
+
+        printIndexFilterCost(&filterHeader);
+    }
+
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,388 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "index.h"
+#include "hash.h"
+#include "table.h"
+#include "sorting.h"
+#include "merging.h"
+#include "defines.h"
+
+#define DEFAULT_DEHASH_MEMORY 1024 // MiB for the digests sort, the spilled runs are merged within the same budget
+
+// The digests to join in hash order, either sorted in memory or merged from the runs spilled to a file
+typedef struct {
+    uint8_t* digests;
+    uint8_t digestSize;
+    uint64_t count;
+    uint64_t position;
+    EntryMerger* merger;
+} DigestSource;
+
+uint8_t* nextDigest(DigestSource* source)
+{
+    if(source->merger != NULL)
+    {
+        return nextMergedEntry(source->merger, NULL);
+    }
+
+    if(source->position == source->count)
+    {
+        return NULL;
+    }
+
+    return source->digests + source->position++ * source->digestSize;
+}
+
+uint64_t getRunDigestsCount(uint64_t run, uint64_t runDigests, uint64_t digestsCount)
+{
+    uint64_t left = digestsCount - run * runDigests;
+
+    return (left < runDigests) ? left : runDigests;
+}
+
+// Streams the sorted digests against the sorted index entries: the index is only read forward, and the directory
+// skips the buckets without any digest. Only the entries with the prefix of a digest are decoded and hashed. The
+// found digests are written as "<hex digest>:<word>" lines. The entries read must not go down, an unsorted index would
+// make the join miss most digests.
+int joinDigests(IndexTable* table, DigestSource* source, FILE* output, uint64_t* found)
+{
+    uint8_t digestSize = table->hashInfos.digestSize, indexEntrySize = table->indexEntrySize;
+    uint8_t* digest, *digestTmp = malloc(digestSize), *word = malloc(MAX_LINE_SIZE);
+    char* line = malloc(2 * digestSize + 1 + MAX_LINE_SIZE + 1);
+    uint64_t key, entryKey, lastKey = 0, bucketStart;
+    int64_t position = 0;
+    size_t wordLength;
+    int error = 0;
+
+    if((digestTmp == NULL) || (word == NULL) || (line == NULL))
+    {
+        printf("Unable to allocate the join buffers.\n");
+
+        free(digestTmp);
+        free(word);
+        free(line);
+        return 1;
+    }
+
+    *found = 0;
+
+    while(((digest = nextDigest(source)) != NULL) && !error)
+    {
+        key = getEntryKey(digest);
+
+        if(table->directory != NULL)
+        {
+            bucketStart = table->directory[key >> (64 - INDEX_DIRECTORY_BITS)];
+            position = ((uint64_t) position < bucketStart) ? (int64_t) bucketStart : position;
+        }
+
+        while((position < table->indexesCount)
+              && ((entryKey = getEntryKey(table->index + position * indexEntrySize)) < key))
+        {
+            if(entryKey < lastKey)
+            {
+                printf("The index must be sorted.\n");
+                error = 1;
+                break;
+            }
+
+            lastKey = entryKey;
+            position++;
+        }
+
+        if(error)
+        {
+            break;
+        }
+
+        // The position stays on the first entry of the prefix, the next digest may share it
+        resolveEntry(table, digestTmp, digest, position, word, &wordLength);
+
+        if(wordLength != LOOKUP_NOT_FOUND)
+        {
+            hex(digest, digestSize, line);
+            line[2 * digestSize] = ':';
+            memcpy(line + 2 * digestSize + 1, word, wordLength);
+            line[2 * digestSize + 1 + wordLength] = '\n';
+
+            if(fwrite(line, 2 * digestSize + wordLength + 2, 1, output) != 1)
+            {
+                printf("Unable to write the results.\n");
+                error = 1;
+            }
+
+            (*found)++;
+        }
+    }
+
+    free(digestTmp);
+    free(word);
+    free(line);
+
+    return error;
+}
+
+// Sorts the digests of a file by hash prefix and merge-joins them against a sorted index, so the index is read
+// sequentially instead of being searched once per digest. The digests that do not fit in the memory budget are sorted
+// by runs spilled to a temporary file, then merged while joining.
+int main(int argc, char** argv)
+{
+    WordlistReader digestsReader;
+    IndexTable table;
+    FILE* output, *runsFile = NULL;
+    char* runsPath;
+    const char* line;
+    size_t length, streamBufferSize;
+    uint64_t memory = DEFAULT_DEHASH_MEMORY * (uint64_t) MIB, runDigests, digestsCount = 0, runsCount = 0;
+    uint64_t runCount = 0, invalidCount = 0, found = 0, offset = 0, i;
+    uint32_t threadsCount = 1;
+    uint8_t digestSize;
+    uint8_t* memoryBuffer;
+    EntryStream* streams = NULL;
+    EntryMerger merger;
+    DigestSource source;
+    int ret, error = 0;
+
+    if(argc < 4)
+    {
+        printf("Usage: %s <index_file> <digests_file> <output_file> [--memory <MiB>] [--threads <count>]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for(i=4 ; i<(uint64_t) argc ; i++)
+    {
+        if((strcmp(argv[i], "--memory") == 0) && (i + 1 < (uint64_t) argc))
+        {
+            memory = strtol(argv[++i], NULL, 10) * (uint64_t) MIB;
+        }
+        else if((strcmp(argv[i], "--threads") == 0) && (i + 1 < (uint64_t) argc))
+        {
+            threadsCount = strtol(argv[++i], NULL, 10);
+
+            // 0 uses every online core
+            if(threadsCount == 0)
+            {
+                threadsCount = sysconf(_SC_NPROCESSORS_ONLN);
+            }
+        }
+        else
+        {
+            printf("Unknown option: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    ret = openIndexTable(argv[1], &table);
+
+    if(ret)
+    {
+        if(ret == 1)
+        {
+            printf("Unable to open the index file.\n");
+        }
+        else if(ret == 2)
+        {
+            printf("Invalid index file.\n");
+        }
+        else
+        {
+            printf("Unable to find the hash function named: %s\n", table.header.hashName);
+        }
+
+        closeIndexTable(&table);
+        return EXIT_FAILURE;
+    }
+
+    // The index is mapped from the page cache, it does not have to fit in memory
+    if(loadIndexTable(&table, TABLE_MMAP))
+    {
+        printf("Unable to load the index.\n");
+
+        closeIndexTable(&table);
+        return EXIT_FAILURE;
+    }
+
+    digestSize = table.hashInfos.digestSize;
+    // The digests are sorted like index entries: by their first INDEX_HASH_SIZE bytes. Half of the budget is the radix
+    // sort work buffer.
+    runDigests = memory / 2 / digestSize;
+    memoryBuffer = (runDigests != 0) ? malloc(2 * runDigests * digestSize) : NULL;
+
+    if(memoryBuffer == NULL)
+    {
+        printf((runDigests == 0) ? "The memory budget is too small.\n" : "Unable to allocate the sort buffers.\n");
+
+        closeIndexTable(&table);
+        return EXIT_FAILURE;
+    }
+
+    if(openWordlist(argv[2], &digestsReader))
+    {
+        printf("Unable to open the digests file.\n");
+
+        free(memoryBuffer);
+        closeIndexTable(&table);
+        return EXIT_FAILURE;
+    }
+
+    output = fopen(argv[3], "w");
+
+    if(output == NULL)
+    {
+        printf("Unable to create the output file.\n");
+
+        closeWordlist(&digestsReader);
+        free(memoryBuffer);
+        closeIndexTable(&table);
+        return EXIT_FAILURE;
+    }
+
+    while(!error && ((ret = nextWord(&digestsReader, &line, &length)) != 0))
+    {
+        if(ret < 0)
+        {
+            printf("Error: the line is too long (larger than %u characters).\n", MAX_LINE_SIZE - 1);
+            error = 1;
+            break;
+        }
+
+        if((length != 2 * (size_t) digestSize) || !isHex(line, length))
+        {
+            invalidCount++;
+            continue;
+        }
+
+        unhex((char*) line, memoryBuffer + runCount * digestSize, digestSize);
+        runCount++;
+        digestsCount++;
+
+        if(runCount < runDigests)
+        {
+            continue;
+        }
+
+        // The runs file is only reachable through its descriptor, so it goes away however the program ends
+        if(runsFile == NULL)
+        {
+            runsPath = malloc(strlen(argv[3]) + sizeof(RUNS_FILE_SUFFIX));
+
+            if(runsPath != NULL)
+            {
+                sprintf(runsPath, "%s%s", argv[3], RUNS_FILE_SUFFIX);
+                runsFile = fopen(runsPath, "w+");
+                unlink(runsPath);
+                free(runsPath);
+            }
+
+            if(runsFile == NULL)
+            {
+                printf("Unable to create the runs file.\n");
+                error = 1;
+                break;
+            }
+        }
+
+        sortIndexEntriesParallel(memoryBuffer, memoryBuffer + runDigests * digestSize, runCount, digestSize, SORT_RADIX,
+                                 threadsCount);
+
+        if(fwrite(memoryBuffer, runCount * digestSize, 1, runsFile) != 1)
+        {
+            printf("Unable to write the sorted runs.\n");
+            error = 1;
+        }
+
+        runsCount++;
+        runCount = 0;
+    }
+
+    closeWordlist(&digestsReader);
+
+    if(!error && (runsFile == NULL))
+    {
+        sortIndexEntriesParallel(memoryBuffer, memoryBuffer + runDigests * digestSize, runCount, digestSize, SORT_RADIX,
+                                 threadsCount);
+
+        source.digests = memoryBuffer;
+        source.digestSize = digestSize;
+        source.count = runCount;
+        source.position = 0;
+        source.merger = NULL;
+    }
+    else if(!error)
+    {
+        if(runCount > 0)
+        {
+            sortIndexEntriesParallel(memoryBuffer, memoryBuffer + runDigests * digestSize, runCount, digestSize,
+                                     SORT_RADIX, threadsCount);
+
+            error = (fwrite(memoryBuffer, runCount * digestSize, 1, runsFile) != 1);
+            runsCount++;
+        }
+
+        // The whole budget is now shared between the run streams
+        streamBufferSize = 2 * runDigests * digestSize / runsCount;
+        streams = malloc(runsCount * sizeof(EntryStream));
+
+        if(error || fflush(runsFile) || (streamBufferSize < digestSize) || (streams == NULL))
+        {
+            printf("Unable to merge the %lu sorted runs.\n", runsCount);
+            error = 1;
+        }
+
+        for(i=0 ; (i<runsCount) && !error ; i++)
+        {
+            openEntryStream(&streams[i], fileno(runsFile), offset, getRunDigestsCount(i, runDigests, digestsCount),
+                            digestSize, memoryBuffer + i * streamBufferSize, streamBufferSize);
+
+            offset += getRunDigestsCount(i, runDigests, digestsCount) * digestSize;
+        }
+
+        if(!error && initEntryMerger(&merger, streams, runsCount))
+        {
+            printf("Unable to allocate the merge heap.\n");
+            error = 1;
+        }
+
+        source.merger = &merger;
+    }
+
+    if(!error)
+    {
+        printf("%lu digests sorted in %lu runs, %lu invalid lines skipped.\n", digestsCount, runsCount ? runsCount : 1,
+               invalidCount);
+
+        error = joinDigests(&table, &source, output, &found);
+
+        if(source.merger != NULL)
+        {
+            freeEntryMerger(&merger);
+        }
+    }
+
+    if(!error)
+    {
+        printf("%lu / %lu digests found.\n", found, digestsCount);
+    }
+
+    if(fclose(output) && !error)
+    {
+        printf("Unable to write the results.\n");
+        error = 1;
+    }
+
+    if(runsFile != NULL)
+    {
+        fclose(runsFile);
+    }
+
+    free(streams);
+    free(memoryBuffer);
+    closeIndexTable(&table);
+
+    return error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -2,91 +2,14 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "utils.h"
 #include "index.h"
 #include "hash.h"
+#include "table.h"
 #include "defines.h"
 
-void readWord(uint8_t* indexData, uint8_t* wordlist, uint8_t indexDataSize, uint8_t* out)
-{
-    uint8_t* word = indexData;
-    uint8_t lastByte = indexData[indexDataSize - 1];
-
-    if(!(lastByte & INLINE_WORD_MASK))
-    {
-        word = wordlist + getPointerFromData(indexData, indexDataSize);
-    }
-
-    switch((lastByte & WORD_TYPE_MASK) >> INLINE_WORD_BITS)
-    {
-        case NUMERIC:
-            uncompressNumeric(word, out);
-            break;
-
-        case ALPHANUMERIC:
-            uncompressAlphanumeric(word, out);
-            break;
-
-        case REDUCED_ASCII:
-            uncompressReducedASCII(word, out);
-            break;
-
-        default:
-            strcpy((char*) out, (char*) word);
-            break;
-    }
-}
-
-void lookup(uint8_t* index, uint8_t* wordlist, uint64_t indexesCount, uint8_t indexEntrySize, uint8_t indexDataSize,
-            HashInfos* hashInfos, uint8_t* digestTmp, uint8_t* hash, uint8_t* out)
-{
-    uint64_t l = 0, u = indexesCount - 1, m;
-    int cmp;
-
-    *out = '\0';
-
-    while(u >= l)
-    {
-        m = l + (u - l) / 2;
-        cmp = memcmp(index + m * indexEntrySize, hash, INDEX_HASH_SIZE);
-
-        if(cmp > 0)
-        {
-            u = m - 1;
-        }
-        else if(cmp < 0)
-        {
-            l = m + 1;
-        }
-        else
-        {
-            while((m != 0xFFFFFFFFFFFFFFFFL) && (memcmp(index + m * indexEntrySize, hash, INDEX_HASH_SIZE) == 0))
-            {
-                m--;
-            }
-
-            m++;
-
-            while((m < indexesCount) && (memcmp(index + m * indexEntrySize, hash, INDEX_HASH_SIZE) == 0))
-            {
-                readWord(index + m * indexEntrySize + INDEX_HASH_SIZE, wordlist, indexDataSize, out);
-                hashInfos->f(out, strlen((char*) out), digestTmp);
-
-                if(memcmp(hash, digestTmp, hashInfos->digestSize) == 0)
-                {
-                    return;
-                }
-
-                *out = '\0'; // Put a 0 again on the first output byte to know when a result is found or not.
-                m++;
-            }
-
-            return;
-        }
-    }
-}
-
 void showProgress(uint64_t goodAnswers, uint64_t totalAnswers, uint64_t nullBytesPasswords)
 {
     uint64_t badAnswers = totalAnswers - goodAnswers - nullBytesPasswords;
@@ -98,152 +21,181 @@ void showProgress(uint64_t goodAnswers, uint64_t totalAnswers, uint64_t nullByte
 
 int main(int argc, char** argv)
 {
-    uint8_t answer, indexEntrySize, indexDataSize;
-    uint64_t bufSize, indexesCount;
-    FILE* indexFile, *wordlistFile;
-    IndexHeader indexHeader;
-    HashInfos hashInfos;
-    uint8_t* index = NULL, *wordlist = NULL, *digest = NULL, *digestTmp = NULL;
-    uint8_t lookupResult[MAX_LINE_SIZE];
-    char line[MAX_LINE_SIZE] = {0};
-    char* tmp;
-    size_t lineLength;
+    uint8_t answer;
+    uint32_t tableFlags = 0;
+    uint64_t bufSize;
+    WordlistReader wordlistReader;
+    IndexTable table;
+    uint8_t* digests = NULL, *digestTmp = NULL, *lookupResults = NULL;
+    uint8_t* outs[HASH_BATCH_SIZE];
+    size_t lookupResultLens[HASH_BATCH_SIZE];
+    char* lines = NULL;
+    const char* line, *batchLines[HASH_BATCH_SIZE];
+    const unsigned char* words[HASH_BATCH_SIZE];
+    size_t lineLengths[HASH_BATCH_SIZE], wordLengths[HASH_BATCH_SIZE];
+    uint32_t i, linesCount, wordsCount;
+    int ret, error;
     uint64_t goodAnswers = 0, totalAnswers = 0, nullBytesPasswords = 0;
 
     setvbuf(stdin, NULL, _IONBF, 0);
     setvbuf(stdout, NULL, _IONBF, 0);
 
-    if(argc != 3)
+    if(argc < 3)
     {
-        printf("Usage: %s <index_file> <wordlist_file>\n", argv[0]);
+        printf("Usage: %s <index_file> <wordlist_file> %s\n", argv[0], getTableOptionsUsage());
         return EXIT_FAILURE;
     }
 
-    wordlistFile = fopen(argv[2], "r");
-
-    if(wordlistFile == NULL)
+    for(i=3 ; i<(uint32_t) argc ; i++)
     {
-        printf("Unable to open the wordlist file.\n");
-        return EXIT_FAILURE;
+        if(parseTableOption(argv[i], &tableFlags))
+        {
+            printf("Unknown option: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
     }
 
-    indexFile = fopen(argv[1], "r");
-
-    if(indexFile == NULL)
+    if(openWordlist(argv[2], &wordlistReader))
     {
-        printf("Unable to open the index file.\n");
+        printf("Unable to open the wordlist file.\n");
         return EXIT_FAILURE;
     }
 
-    if(readIndexHeader(indexFile, &indexHeader))
+    error = openIndexTable(argv[1], &table);
+
+    if(error)
     {
-        printf("Invalid index file.\n");
+        if(error == 1)
+        {
+            printf("Unable to open the index file.\n");
+        }
+        else if(error == 2)
+        {
+            printf("Invalid index file.\n");
+        }
+        else
+        {
+            printf("Unable to find the hash function named: %s\n", table.header.hashName);
+        }
 
-        fclose(indexFile);
+        closeIndexTable(&table);
         return EXIT_FAILURE;
     }
 
-    indexEntrySize = getIndexEntrySize(&indexHeader);
-    indexDataSize = indexHeader.dataBytes;
-    indexesCount = getIndexesCount(&indexHeader);
-
-    getHashInfos(indexHeader.hashName, &hashInfos);
+    lines = wordlistReader.mapped ? NULL : malloc(HASH_BATCH_SIZE * MAX_LINE_SIZE);
+    digests = malloc(HASH_BATCH_SIZE * table.hashInfos.digestSize);
+    digestTmp = malloc(table.hashInfos.digestSize);
+    lookupResults = malloc(HASH_BATCH_SIZE * MAX_LINE_SIZE);
 
-    if(hashInfos.f == NULL)
+    for(i=0 ; i<HASH_BATCH_SIZE ; i++)
     {
-        printf("Unable to find the hash function named: %s\n", indexHeader.hashName);
-
-        fclose(indexFile);
-        return EXIT_FAILURE;
+        outs[i] = lookupResults + i * MAX_LINE_SIZE;
     }
 
-    digest = malloc(hashInfos.digestSize);
-    digestTmp = malloc(hashInfos.digestSize);
-
-    fseek(indexFile, 0, SEEK_END);
-    bufSize = ftell(indexFile) - sizeof(IndexHeader);
-    fseek(indexFile, sizeof(IndexHeader), SEEK_SET);
+    bufSize = getIndexTableAllocation(&table, tableFlags);
 
-    printf("WARNING: This program will allocate %lu MiB of RAM. Do you want to continue? (y/N)\n", bufSize / MIB);
-    answer = getchar();
-
-    if((answer != 'y') && (answer != 'Y'))
+    // Nothing to confirm when the index is only mapped from the page cache, without a search tree
+    if((bufSize != 0) && isatty(STDIN_FILENO))
     {
-        printf("ABORTING\n");
+        printf("WARNING: This program will allocate %lu MiB of RAM. Do you want to continue? (y/N)\n", bufSize / MIB);
+        answer = getchar();
 
-        fclose(indexFile);
-        return EXIT_FAILURE;
-    }
+        if((answer != 'y') && (answer != 'Y'))
+        {
+            printf("ABORTING\n");
 
-    index = malloc(bufSize);
+            closeIndexTable(&table);
+            return EXIT_FAILURE;
+        }
+    }
 
-    if(index == NULL)
+    if(loadIndexTable(&table, tableFlags))
     {
-        printf("Unable to allocate the index.\n");
+        printf("Unable to load the index.\n");
 
-        fclose(indexFile);
+        closeIndexTable(&table);
         return EXIT_FAILURE;
     }
 
-    wordlist = index + indexHeader.wordlistOffset;
-    fread(index, sizeof(uint8_t), bufSize, indexFile);
-
-    fclose(indexFile);
-
     printf("The index is loaded successfully.\n");
 
-    while(fgets(line, MAX_LINE_SIZE, wordlistFile) != NULL)
+    // The lines are read HASH_BATCH_SIZE at a time so their digests can be computed by the multi-buffer kernels
+    do
     {
-        tmp = memchr(line, '\r', MAX_LINE_SIZE);
-
-        if(tmp == NULL)
+        for(linesCount=0, wordsCount=0 ; linesCount<HASH_BATCH_SIZE ; linesCount++)
         {
-            tmp = memchr(line, '\n', MAX_LINE_SIZE);
-        }
+            ret = nextWord(&wordlistReader, &line, &lineLengths[linesCount]);
 
-        if(tmp == NULL)
-        {
-            printf("Error: the line is too long (larger than %u characters).\n", MAX_LINE_SIZE - 1);
-            return EXIT_FAILURE;
-        }
+            if(ret == 0)
+            {
+                break;
+            }
+            else if(ret < 0)
+            {
+                printf("Error: the line is too long (larger than %u characters).\n", MAX_LINE_SIZE - 1);
+                return EXIT_FAILURE;
+            }
 
-        *tmp = '\0';
-        lineLength = tmp - line;
+            // A streamed word is only valid until the next read
+            if(!wordlistReader.mapped)
+            {
+                memcpy(lines + linesCount * MAX_LINE_SIZE, line, lineLengths[linesCount]);
+                line = lines + linesCount * MAX_LINE_SIZE;
+            }
 
-        if(strlen(line) != lineLength)
-        {
-            nullBytesPasswords++;
+            batchLines[linesCount] = line;
+
+            if(memchr(line, '\0', lineLengths[linesCount]) == NULL)
+            {
+                words[wordsCount] = (unsigned char*) line;
+                wordLengths[wordsCount] = lineLengths[linesCount];
+                wordsCount++;
+            }
         }
-        else
+
+        table.hashInfos.batch(words, wordLengths, wordsCount, digests);
+        lookupBatch(&table, digestTmp, digests, wordsCount, outs, lookupResultLens);
+
+        for(i=0, wordsCount=0 ; i<linesCount ; i++)
         {
-            hashInfos.f((uint8_t*) line, lineLength, digest);
-            lookup(index, wordlist, indexesCount, indexEntrySize, indexDataSize, &hashInfos, digestTmp, digest, lookupResult);
+            line = batchLines[i];
 
-            if(memcmp(line, lookupResult, lineLength) == 0)
+            if(memchr(line, '\0', lineLengths[i]) != NULL)
             {
-                goodAnswers++;
+                nullBytesPasswords++;
             }
             else
             {
-                printf("ERROR: %s\n", line);
-            }
-        }
+                if(memcmp(line, outs[wordsCount], lineLengths[i]) == 0)
+                {
+                    goodAnswers++;
+                }
+                else
+                {
+                    printf("ERROR: %.*s\n", (int) lineLengths[i], line);
+                }
 
-        memset(line, '\0', MAX_LINE_SIZE);
+                wordsCount++;
+            }
 
-        totalAnswers++;
+            totalAnswers++;
 
-        if((totalAnswers % PROGRESS_UPDATE_COUNT) == 0)
-        {
-            showProgress(goodAnswers, totalAnswers, nullBytesPasswords);
+            if((totalAnswers % PROGRESS_UPDATE_COUNT) == 0)
+            {
+                showProgress(goodAnswers, totalAnswers, nullBytesPasswords);
+            }
         }
-    }
+    } while(linesCount == HASH_BATCH_SIZE);
 
     showProgress(goodAnswers, totalAnswers, nullBytesPasswords);
 
-    free(index);
-    free(digest);
+    closeIndexTable(&table);
+    free(lines);
+    free(digests);
     free(digestTmp);
+    free(lookupResults);
+
+    closeWordlist(&wordlistReader);
 
     return EXIT_SUCCESS;
 }
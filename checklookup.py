@@ -2,11 +2,14 @@ import argparse
 import socket
 import time
 import hashlib
+import struct
 from rich.progress import Progress, TimeElapsedColumn, TextColumn, BarColumn
 
 
-MAX_LINE_SIZE = 8192
+PIPELINE_SIZE = 1000
 PROGRESS_UPDATE_TIME = 1
+BINARY_MAGIC = b'\0BIN'
+BINARY_MISS = 0xFFFF
 
 
 def parse_args():
@@ -15,18 +18,79 @@ def parse_args():
     parser.add_argument('wordlist')
     parser.add_argument('hashname')
     parser.add_argument('lookup', help='hostname:port of the lookup table')
+    parser.add_argument('--binary', action='store_true', help='send raw digests with the binary protocol')
 
     return parser.parse_args()
 
 
-def dehash(lookup, hash):
-    lookup.send(hash.encode('ascii'))
-    result = lookup.recv(MAX_LINE_SIZE)
+def dehash(lookup, answers, hashes):
+    lookup.sendall(b''.join(h.encode('ascii') + b'\n' for h in hashes))
+    results = []
 
-    if result == b'\n':
-        return None
+    # The answers come in the requests order, one line each
+    for _ in hashes:
+        result = answers.readline()
 
-    return result[:-1]
+        if not result.endswith(b'\n'):
+            raise ConnectionError('The lookup table closed the connection')
+
+        results.append(result[:-1] if result != b'\n' else None)
+
+    return results
+
+
+def read_exactly(answers, size):
+    data = answers.read(size)
+
+    if len(data) != size:
+        raise ConnectionError('The lookup table closed the connection')
+
+    return data
+
+
+def open_binary(lookup, answers):
+    lookup.sendall(BINARY_MAGIC)
+
+    # The magic comes back followed by the digest size
+    if read_exactly(answers, len(BINARY_MAGIC) + 1)[:len(BINARY_MAGIC)] != BINARY_MAGIC:
+        raise ConnectionError('The lookup table does not speak the binary protocol')
+
+
+def dehash_binary(lookup, answers, digests):
+    lookup.sendall(struct.pack('<I', len(digests)) + b''.join(digests))
+    results = []
+
+    # The answers come in the requests order, each one prefixed by its length
+    for _ in digests:
+        length, = struct.unpack('<H', read_exactly(answers, 2))
+        results.append(read_exactly(answers, length) if length != BINARY_MISS else None)
+
+    return results
+
+
+def check_lines(lookup, answers, hashname, lines, found, error, binary=False):
+    digests = []
+
+    for line in lines:
+        h = hashlib.new(hashname)
+
+        h.update(line)
+        digests.append(h.digest() if binary else h.hexdigest())
+
+    try:
+        results = dehash_binary(lookup, answers, digests) if binary else dehash(lookup, answers, digests)
+    except Exception as e:
+        print(f'An error occurred while dehashing the words: {e}')
+        exit(1)
+
+    for line, dehashed in zip(lines, results):
+        if dehashed is not None:
+            if line == dehashed:
+                found += 1
+            else:
+                error += 1
+
+    return found, error
 
 
 def clean_line(line):
@@ -43,6 +107,15 @@ if __name__ == '__main__':
     lookup_hostname, lookup_port = args.lookup.split(':')
     wordlist_name = args.wordlist.split('/')[-1]
     lookup = socket.create_connection((lookup_hostname, lookup_port))
+    answers = lookup.makefile('rb')
+
+    if args.binary:
+        try:
+            open_binary(lookup, answers)
+        except Exception as e:
+            print(f'An error occurred while opening the binary protocol: {e}')
+            exit(1)
+
     found = 0
     error = 0
     total = 0
@@ -60,28 +133,20 @@ if __name__ == '__main__':
     task = progressbar.add_task(f'{wordlist_name}', total=0, completed=0, error=0, dehash_per_second=0)
     progressbar.start()
 
+    dehash_per_second = 0
+
     with open(args.wordlist, 'r', encoding='latin1') as wordlist:
+        lines = []
+
         for line in wordlist:
-            line = clean_line(line)
-            h = hashlib.new(args.hashname)
-
-            h.update(line)
-            digest = h.hexdigest()
-
-            try:
-                dehashed = dehash(lookup, digest)
-            except:
-                line = line.decode('latin1')
-                print(f'An error occurred while dehashing the word: {line}')
-                exit(1)
-
-            if dehashed is not None:
-                if line == dehashed:
-                    found += 1
-                else:
-                    error += 1
-
-            total += 1
+            lines.append(clean_line(line))
+
+            if len(lines) < PIPELINE_SIZE:
+                continue
+
+            found, error = check_lines(lookup, answers, args.hashname, lines, found, error, args.binary)
+            total += len(lines)
+            lines = []
             current_ts = time.time()
             delta = current_ts - ts
 
@@ -93,6 +158,10 @@ if __name__ == '__main__':
                 last_total = total
                 ts = current_ts
 
+        if lines:
+            found, error = check_lines(lookup, answers, args.hashname, lines, found, error, args.binary)
+            total += len(lines)
+
     progressbar.update(task, completed=found, total=total, error=error, dehash_per_second=dehash_per_second)
 
     progressbar.stop()
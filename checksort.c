@@ -58,6 +58,7 @@ int main(int argc, char **argv)
     currentEntry = malloc(indexEntrySize);
     nextEntry = malloc(indexEntrySize);
 
+    fseek(indexFile, getIndexEntriesOffset(&indexHeader), SEEK_SET);
     fread(currentEntry, indexEntrySize, 1, indexFile);
 
     for(i=0 ; i<(entriesCount-1) ; i++)
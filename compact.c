@@ -0,0 +1,431 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "index.h"
+#include "merging.h"
+#include "segments.h"
+#include "filter.h"
+#include "defines.h"
+
+#define DEFAULT_MAX_SEGMENTS 4
+#define DEFAULT_FAN_IN 4 // Segments folded at once
+#define THROTTLE_ENTRIES 65536 // Entries merged between two checks of the I/O budget
+#define COMPACTED_SEGMENT_NAME "compacted-%ld-%u.idx"
+
+typedef struct {
+    FILE* f;
+    IndexHeader header;
+    uint64_t size;
+} SegmentFile;
+
+// Bytes read and written so far against a budget in bytes per second, 0 for no limit
+typedef struct {
+    uint64_t budget;
+    uint64_t bytes;
+    double start;
+} IOThrottle;
+
+double getTime()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Sleeps as long as the I/O done is ahead of the budget
+void throttleIO(IOThrottle* throttle, uint64_t bytes)
+{
+    double ahead;
+
+    throttle->bytes += bytes;
+
+    if(throttle->budget == 0)
+    {
+        return;
+    }
+
+    ahead = (double) throttle->bytes / throttle->budget - (getTime() - throttle->start);
+
+    if(ahead > 0)
+    {
+        usleep(ahead * 1e6);
+    }
+}
+
+uint64_t getSegmentWordlistSize(SegmentFile* segment)
+{
+    return segment->size - segment->header.wordlistOffset - getIndexEntriesOffset(&segment->header);
+}
+
+int copySegmentWordlist(SegmentFile* segment, FILE* output, uint8_t* buffer, IOThrottle* throttle)
+{
+    uint64_t offset = getIndexEntriesOffset(&segment->header) + segment->header.wordlistOffset;
+    ssize_t readSize;
+
+    while((readSize = pread(fileno(segment->f), buffer, READ_BUFFER_SIZE, offset)) > 0)
+    {
+        if(fwrite(buffer, readSize, 1, output) != 1)
+        {
+            return 1;
+        }
+
+        offset += readSize;
+        throttleIO(throttle, 2 * readSize);
+    }
+
+    return readSize < 0;
+}
+
+// Merges the segments into a new index with a directory. The newest segment comes first, so its entries stay in front
+// of the older ones with the same hash.
+int foldSegments(SegmentFile* segments, uint32_t segmentsCount, const char* outputPath, IOThrottle* throttle)
+{
+    uint8_t indexEntrySize = getIndexEntrySize(&segments[0].header), dataBytes = segments[0].header.dataBytes;
+    uint64_t wordlistBases[MAX_SEGMENTS], totalWordlistSize = 0, wordlistOffset, k;
+    uint8_t* readBuffers, *writeBuffer, *entry;
+    EntryStream streams[MAX_SEGMENTS];
+    EntryMerger merger;
+    EntryWriter entries;
+    FILE* outputFile;
+    uint32_t source, i;
+    int error = 0;
+
+    for(i=0 ; i<segmentsCount ; i++)
+    {
+        if((segments[i].header.dataBytes != dataBytes)
+           || (memcmp(segments[i].header.hashName, segments[0].header.hashName, MAX_HASH_NAME_SIZE) != 0))
+        {
+            printf("The segments do not have the same hash function and data bytes.\n");
+            return 1;
+        }
+
+        wordlistBases[i] = totalWordlistSize;
+        totalWordlistSize += getSegmentWordlistSize(&segments[i]);
+    }
+
+    if(!isDataSizeValid(totalWordlistSize, dataBytes << 3))
+    {
+        printf("The merged wordlist is too large for %u data bytes.\n", dataBytes);
+        return 1;
+    }
+
+    readBuffers = malloc(segmentsCount * (size_t) READ_BUFFER_SIZE);
+    writeBuffer = malloc(WRITE_BUFFER_SIZE);
+    outputFile = fopen(outputPath, "w+");
+
+    if((readBuffers == NULL) || (writeBuffer == NULL) || (outputFile == NULL))
+    {
+        printf("Unable to set up the merge.\n");
+
+        if(outputFile != NULL)
+        {
+            fclose(outputFile);
+            unlink(outputPath);
+        }
+
+        free(readBuffers);
+        free(writeBuffer);
+        return 1;
+    }
+
+    for(i=0 ; i<segmentsCount ; i++)
+    {
+        openEntryStream(&streams[i], fileno(segments[i].f), getIndexEntriesOffset(&segments[i].header),
+                        getIndexesCount(&segments[i].header), indexEntrySize, readBuffers + i * (size_t) READ_BUFFER_SIZE,
+                        READ_BUFFER_SIZE);
+    }
+
+    error = initEntryMerger(&merger, streams, segmentsCount);
+
+    // This header and the directory are only placeholders for now.
+    writeIndexHeader(outputFile, INDEX_MAGIC_DIRECTORY, segments[0].header.hashName, dataBytes, 0);
+    reserveIndexDirectory(outputFile);
+    initEntryWriter(&entries, writeBuffer, WRITE_BUFFER_SIZE, outputFile);
+
+    for(k=1 ; !error && ((entry = nextMergedEntry(&merger, &source)) != NULL) ; k++)
+    {
+        if(!(entry[indexEntrySize - 1] & INLINE_WORD_MASK) && (wordlistBases[source] != 0))
+        {
+            writeIndexEntryPointer(entry,
+                                   getPointerFromData(entry + INDEX_HASH_SIZE, dataBytes) + wordlistBases[source],
+                                   dataBytes,
+                                   (entry[indexEntrySize - 1] & WORD_TYPE_MASK) >> INLINE_WORD_BITS,
+                                   &entries);
+        }
+        else
+        {
+            writeIndexEntry(entry, indexEntrySize, &entries);
+        }
+
+        if((k % THROTTLE_ENTRIES) == 0)
+        {
+            throttleIO(throttle, 2 * THROTTLE_ENTRIES * (uint64_t) indexEntrySize);
+        }
+    }
+
+    freeEntryMerger(&merger);
+
+    error |= flushEntryWriter(&entries);
+    wordlistOffset = ftell(outputFile) - sizeof(IndexHeader) - INDEX_DIRECTORY_SIZE;
+
+    for(i=0 ; (i<segmentsCount) && !error ; i++)
+    {
+        error = copySegmentWordlist(&segments[i], outputFile, readBuffers, throttle);
+    }
+
+    rewind(outputFile);
+    writeIndexHeader(outputFile, INDEX_MAGIC_DIRECTORY, segments[0].header.hashName, dataBytes, wordlistOffset);
+    error |= updateIndexDirectory(outputFile);
+
+    // The new segment must be on disk before the manifest points to it
+    error |= fflush(outputFile) || fsync(fileno(outputFile));
+    error |= fclose(outputFile);
+
+    if(error)
+    {
+        printf("Unable to write the compacted segment.\n");
+        unlink(outputPath);
+    }
+
+    free(readBuffers);
+    free(writeBuffer);
+
+    return error;
+}
+
+// Folds the count segments of the manifest from first into a new segment, then points the manifest to it in their
+// place and removes them. The new segment gets a filter if a false positive rate is given.
+int compactSegments(const char* manifestPath, Manifest* manifest, uint32_t first, uint32_t count, IOThrottle* throttle,
+                    double falsePositiveRate)
+{
+    FilterHeader filterHeader;
+    const char* slash = strrchr(manifestPath, '/');
+    size_t directoryLength = (slash == NULL) ? 0 : slash + 1 - manifestPath;
+    SegmentFile segments[MAX_SEGMENTS];
+    char name[64], *outputPath;
+    Manifest updated;
+    uint32_t i, opened;
+    int error = 0;
+
+    // The newest segment is merged first
+    for(opened=0 ; opened<count ; opened++)
+    {
+        segments[opened].f = fopen(manifest->paths[first + count - 1 - opened], "r");
+
+        if((segments[opened].f == NULL) || readIndexHeader(segments[opened].f, &segments[opened].header))
+        {
+            printf("Unable to open the segment %s.\n", manifest->paths[first + count - 1 - opened]);
+
+            if(segments[opened].f != NULL)
+            {
+                fclose(segments[opened].f);
+            }
+
+            error = 1;
+            break;
+        }
+
+        segments[opened].size = getFileSize(segments[opened].f);
+    }
+
+    outputPath = malloc(directoryLength + sizeof(name));
+
+    for(i=0 ; (outputPath != NULL) && !error ; i++)
+    {
+        snprintf(name, sizeof(name), COMPACTED_SEGMENT_NAME, (long) time(NULL), i);
+        sprintf(outputPath, "%.*s%s", (int) directoryLength, manifestPath, name);
+
+        if(access(outputPath, F_OK) != 0)
+        {
+            break;
+        }
+    }
+
+    if(!error)
+    {
+        printf("Folding %u segments from %s to %s...\n", count, manifest->names[first],
+               manifest->names[first + count - 1]);
+
+        error = (outputPath == NULL) || foldSegments(segments, count, outputPath, throttle);
+    }
+
+    if(!error && (falsePositiveRate != 0))
+    {
+        if(writeIndexFilter(outputPath, falsePositiveRate, &filterHeader))
+        {
+            printf("Unable to write the filter of the compacted segment.\n");
+            unlink(outputPath);
+            error = 1;
+        }
+        else
+        {
+            printIndexFilterCost(&filterHeader);
+        }
+    }
+
+    for(i=0 ; i<opened ; i++)
+    {
+        fclose(segments[i].f);
+    }
+
+    if(error)
+    {
+        free(outputPath);
+        return 1;
+    }
+
+    // The folded segments are replaced by the new one, at the place of the oldest of them. The manifest in memory is
+    // only changed once the new one is written.
+    updated.count = 0;
+
+    for(i=0 ; i<manifest->count ; i++)
+    {
+        if((i < first) || (i >= first + count))
+        {
+            updated.names[updated.count] = manifest->names[i];
+            updated.paths[updated.count++] = manifest->paths[i];
+        }
+        else if(i == first)
+        {
+            updated.names[updated.count] = strdup(name);
+            updated.paths[updated.count++] = outputPath;
+        }
+    }
+
+    if((updated.names[first] == NULL) || writeManifest(manifestPath, &updated))
+    {
+        printf("Unable to write the manifest, the new segment %s is not used.\n", outputPath);
+        unlink(outputPath);
+        removeIndexFilter(outputPath);
+
+        free(updated.names[first]);
+        free(outputPath);
+        return 1;
+    }
+
+    // The servers that still have the old segments opened keep them until they reload the manifest
+    for(i=first ; i<first+count ; i++)
+    {
+        unlink(manifest->paths[i]);
+        removeIndexFilter(manifest->paths[i]);
+        free(manifest->names[i]);
+        free(manifest->paths[i]);
+    }
+
+    *manifest = updated;
+
+    printf("Segment %s written, %u segments left.\n", name, manifest->count);
+
+    return 0;
+}
+
+// Folds the adjacent segments of a manifest until it lists at most maxSegments of them. Each time, the adjacent
+// segments taking the less space are folded together, so the small new segments are compacted first and the large
+// old ones are rarely rewritten.
+int main(int argc, char** argv)
+{
+    uint32_t maxSegments = DEFAULT_MAX_SEGMENTS, fanIn = DEFAULT_FAN_IN, count, first, best, i, j;
+    uint64_t size, bestSize;
+    uint64_t sizes[MAX_SEGMENTS];
+    IOThrottle throttle;
+    Manifest manifest;
+    double falsePositiveRate = 0;
+    FILE* f;
+    int error = 0;
+
+    if(argc < 2)
+    {
+        printf("Usage: %s <manifest> [--max-segments <count>] [--fan-in <count>] [--io-budget <MiB/s>] "
+               "[--filter <false_positive_rate>]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    throttle.budget = 0;
+    throttle.bytes = 0;
+    throttle.start = getTime();
+
+    for(i=2 ; i<(uint32_t) argc ; i++)
+    {
+        if((strcmp(argv[i], "--max-segments") == 0) && (i + 1 < (uint32_t) argc))
+        {
+            maxSegments = strtol(argv[++i], NULL, 10);
+        }
+        else if((strcmp(argv[i], "--fan-in") == 0) && (i + 1 < (uint32_t) argc))
+        {
+            fanIn = strtol(argv[++i], NULL, 10);
+        }
+        else if((strcmp(argv[i], "--io-budget") == 0) && (i + 1 < (uint32_t) argc))
+        {
+            throttle.budget = strtol(argv[++i], NULL, 10) * (uint64_t) MIB;
+        }
+        else if((strcmp(argv[i], "--filter") == 0) && (i + 1 < (uint32_t) argc))
+        {
+            if(parseFalsePositiveRate(argv[++i], &falsePositiveRate))
+            {
+                printf("The false positive rate must be between 0 and 1: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else
+        {
+            printf("Unknown option: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if((maxSegments == 0) || (fanIn < 2))
+    {
+        printf("At least one segment must be left, and at least two folded at once.\n");
+        return EXIT_FAILURE;
+    }
+
+    if(readManifest(argv[1], &manifest))
+    {
+        printf("Unable to read the manifest file.\n");
+        return EXIT_FAILURE;
+    }
+
+    while(!error && (manifest.count > maxSegments))
+    {
+        for(i=0 ; i<manifest.count ; i++)
+        {
+            f = fopen(manifest.paths[i], "r");
+            sizes[i] = (f != NULL) ? getFileSize(f) : 0;
+
+            if(f != NULL)
+            {
+                fclose(f);
+            }
+        }
+
+        count = (manifest.count - maxSegments + 1 < fanIn) ? manifest.count - maxSegments + 1 : fanIn;
+        best = 0;
+        bestSize = UINT64_MAX;
+
+        for(first=0 ; first+count<=manifest.count ; first++)
+        {
+            for(j=first, size=0 ; j<first+count ; j++)
+            {
+                size += sizes[j];
+            }
+
+            if(size < bestSize)
+            {
+                best = first;
+                bestSize = size;
+            }
+        }
+
+        error = compactSegments(argv[1], &manifest, best, count, &throttle, falsePositiveRate);
+    }
+
+    freeManifest(&manifest);
+
+    return error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
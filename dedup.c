@@ -0,0 +1,191 @@
+#include "dedup.h"
+
+#define DEDUP_RUN_INITIAL_CAPACITY 16
+
+int initDeduplicator(Deduplicator* dedup, uint8_t dataBytes, EntryWriter* entries, FILE* wordlist)
+{
+    dedup->dataBytes = dataBytes;
+    dedup->entries = entries;
+    dedup->wordlist = wordlist;
+    dedup->wordlistSize = 0;
+    dedup->removedEntries = 0;
+    dedup->error = 0;
+    dedup->runCount = 0;
+    dedup->runCapacity = DEDUP_RUN_INITIAL_CAPACITY;
+    dedup->runEntries = malloc(DEDUP_RUN_INITIAL_CAPACITY * (INDEX_HASH_SIZE + dataBytes));
+    dedup->runWords = malloc(DEDUP_RUN_INITIAL_CAPACITY * MAX_LINE_SIZE);
+    dedup->runItems = malloc(DEDUP_RUN_INITIAL_CAPACITY * sizeof(DedupItem));
+
+    if((dedup->runEntries == NULL) || (dedup->runWords == NULL) || (dedup->runItems == NULL))
+    {
+        freeDeduplicator(dedup);
+        return 1;
+    }
+
+    return 0;
+}
+
+static uint8_t* getRunEntry(Deduplicator* dedup, uint32_t i)
+{
+    return dedup->runEntries + i * (INDEX_HASH_SIZE + dedup->dataBytes);
+}
+
+static int isPointerEntry(Deduplicator* dedup, uint8_t* entry)
+{
+    return !(entry[INDEX_HASH_SIZE + dedup->dataBytes - 1] & INLINE_WORD_MASK);
+}
+
+static WordType getEntryWordType(Deduplicator* dedup, uint8_t* entry)
+{
+    return (entry[INDEX_HASH_SIZE + dedup->dataBytes - 1] & WORD_TYPE_MASK) >> INLINE_WORD_BITS;
+}
+
+// Decodes the word of the i-th entry of the run, the first time only
+static char* getRunWord(Deduplicator* dedup, uint32_t i)
+{
+    DedupItem* item = &dedup->runItems[i];
+    uint8_t* entry = getRunEntry(dedup, i);
+    char* word = dedup->runWords + i * MAX_LINE_SIZE;
+
+    if(!item->decoded)
+    {
+        if(isPointerEntry(dedup, entry)
+           && (getPointerFromData(entry + INDEX_HASH_SIZE, dedup->dataBytes) >= item->wordlistSize))
+        {
+            dedup->error = 1;
+            *word = '\0';
+        }
+        else
+        {
+            readWord(entry + INDEX_HASH_SIZE, item->wordlist, dedup->dataBytes, (uint8_t*) word);
+        }
+
+        item->decoded = 1;
+    }
+
+    return word;
+}
+
+// Writes the entries kept in the run, copying their pointed words to the new wordlist
+static void flushRun(Deduplicator* dedup)
+{
+    uint8_t* entry;
+    uint64_t storedSize;
+    WordType wordType;
+    uint32_t i;
+
+    for(i=0 ; i<dedup->runCount ; i++)
+    {
+        entry = getRunEntry(dedup, i);
+
+        if(!isPointerEntry(dedup, entry))
+        {
+            writeIndexEntry(entry, INDEX_HASH_SIZE + dedup->dataBytes, dedup->entries);
+            continue;
+        }
+
+        wordType = getEntryWordType(dedup, entry);
+        storedSize = getStoredWordSize(wordType, strlen(getRunWord(dedup, i)));
+
+        if(fwrite(dedup->runItems[i].wordlist + getPointerFromData(entry + INDEX_HASH_SIZE, dedup->dataBytes),
+                  storedSize, 1, dedup->wordlist) != 1)
+        {
+            dedup->error = 1;
+        }
+
+        writeIndexEntryPointer(entry, dedup->wordlistSize, dedup->dataBytes, wordType, dedup->entries);
+        dedup->wordlistSize += storedSize;
+    }
+
+    dedup->runCount = 0;
+}
+
+static int growRun(Deduplicator* dedup)
+{
+    uint32_t capacity = dedup->runCapacity * 2;
+    uint8_t* runEntries = realloc(dedup->runEntries, capacity * (INDEX_HASH_SIZE + dedup->dataBytes));
+    char* runWords;
+    DedupItem* runItems;
+
+    if(runEntries == NULL)
+    {
+        return 1;
+    }
+
+    dedup->runEntries = runEntries;
+    runWords = realloc(dedup->runWords, capacity * (size_t) MAX_LINE_SIZE);
+
+    if(runWords == NULL)
+    {
+        return 1;
+    }
+
+    dedup->runWords = runWords;
+    runItems = realloc(dedup->runItems, capacity * sizeof(DedupItem));
+
+    if(runItems == NULL)
+    {
+        return 1;
+    }
+
+    dedup->runItems = runItems;
+    dedup->runCapacity = capacity;
+
+    return 0;
+}
+
+// Entries must come in hash order. wordlist is the wordlist region the entry pointer refers to, and must stay
+// mapped until finishDeduplicator.
+void addDedupEntry(Deduplicator* dedup, uint8_t* entry, uint8_t* wordlist, uint64_t wordlistSize)
+{
+    DedupItem* item;
+    uint32_t i;
+
+    if((dedup->runCount > 0) && (memcmp(getRunEntry(dedup, 0), entry, INDEX_HASH_SIZE) != 0))
+    {
+        flushRun(dedup);
+    }
+
+    if((dedup->runCount == dedup->runCapacity) && growRun(dedup))
+    {
+        dedup->error = 1;
+        flushRun(dedup);
+    }
+
+    memcpy(getRunEntry(dedup, dedup->runCount), entry, INDEX_HASH_SIZE + dedup->dataBytes);
+
+    item = &dedup->runItems[dedup->runCount];
+    item->wordlist = wordlist;
+    item->wordlistSize = wordlistSize;
+    item->decoded = 0;
+
+    // The words are only decoded when several entries share the hash
+    for(i=0 ; i<dedup->runCount ; i++)
+    {
+        if(strcmp(getRunWord(dedup, i), getRunWord(dedup, dedup->runCount)) == 0)
+        {
+            dedup->removedEntries++;
+            return;
+        }
+    }
+
+    dedup->runCount++;
+}
+
+int finishDeduplicator(Deduplicator* dedup)
+{
+    flushRun(dedup);
+
+    return dedup->error;
+}
+
+void freeDeduplicator(Deduplicator* dedup)
+{
+    free(dedup->runEntries);
+    free(dedup->runWords);
+    free(dedup->runItems);
+
+    dedup->runEntries = NULL;
+    dedup->runWords = NULL;
+    dedup->runItems = NULL;
+}
@@ -0,0 +1,40 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "index.h"
+#include "defines.h"
+
+// One entry kept in the current run of equal hashes, with the wordlist its pointer refers to
+typedef struct {
+    uint8_t* wordlist;
+    uint64_t wordlistSize;
+    int decoded;
+} DedupItem;
+
+// Takes sorted entries and writes them without the duplicate (hash, word) pairs. The pointed words of the kept entries
+// are copied to wordlist in entries order, so the new wordlist region holds no duplicate nor unreferenced word.
+typedef struct {
+    uint8_t dataBytes;
+    EntryWriter* entries;
+    FILE* wordlist;
+    uint64_t wordlistSize;
+    uint64_t removedEntries;
+    int error;
+    uint32_t runCount;
+    uint32_t runCapacity;
+    uint8_t* runEntries;
+    char* runWords;
+    DedupItem* runItems;
+} Deduplicator;
+
+int initDeduplicator(Deduplicator* dedup, uint8_t dataBytes, EntryWriter* entries, FILE* wordlist);
+void addDedupEntry(Deduplicator* dedup, uint8_t* entry, uint8_t* wordlist, uint64_t wordlistSize);
+int finishDeduplicator(Deduplicator* dedup);
+void freeDeduplicator(Deduplicator* dedup);
+
+#endif //DEDUP_H
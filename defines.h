@@ -4,5 +4,9 @@
 #define MAX_LINE_SIZE 4096
 #define PROGRESS_UPDATE_COUNT 1000000
 #define MIB (1024 * 1024)
+#define WRITE_BUFFER_SIZE (4 * MIB)
+#define READ_BUFFER_SIZE (4 * MIB)
+#define RUNS_FILE_SUFFIX ".runs"
+#define WORDS_FILE_SUFFIX ".words"
 
 #endif //DEFINES_H
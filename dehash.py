@@ -9,7 +9,7 @@ import warnings
 warnings.filterwarnings('ignore', category=elasticsearch.ElasticsearchDeprecationWarning)
 
 
-MAX_LINE_SIZE = 8192
+PIPELINE_SIZE = 1000
 DOCUMENTS_BUFFER_SIZE = 500000
 ELASTICSEARCH_TIMEOUT = 300
 
@@ -63,17 +63,23 @@ def parse_args():
     return parser.parse_args()
 
 
-def dehash(lookup, hash):
-    lookup.send(hash.encode('ascii'))
-    result = lookup.recv(MAX_LINE_SIZE)
+def dehash(lookup, answers, hashes):
+    lookup.sendall(b''.join(h.encode('ascii') + b'\n' for h in hashes))
+    plaintexts = []
 
-    if result == b'\n':
-        return None
+    # The answers come in the requests order, one line each
+    for _ in hashes:
+        result = answers.readline()
 
-    try:
-        return result[:-1].decode('utf-8')
-    except UnicodeDecodeError:
-        return None
+        if not result.endswith(b'\n'):
+            raise ConnectionError('The lookup table closed the connection')
+
+        try:
+            plaintexts.append(result[:-1].decode('utf-8') if result != b'\n' else None)
+        except UnicodeDecodeError:
+            plaintexts.append(None)
+
+    return plaintexts
 
 
 if __name__ == '__main__':
@@ -81,6 +87,7 @@ if __name__ == '__main__':
     elastic = elasticsearch.Elasticsearch([args.elasticsearch])
     lookup_hostname, lookup_port = args.lookup.split(':')
     lookup = socket.create_connection((lookup_hostname, lookup_port))
+    answers = lookup.makefile('rb')
     found = 0
     total = 0
     last_total = 0
@@ -112,15 +119,16 @@ if __name__ == '__main__':
             i = 0
             ts = time.time()
 
-            for result in results:
-                h = result['_source']['hash']
-                plaintext = dehash(lookup, h)
+            for start in range(0, len(results), PIPELINE_SIZE):
+                chunk = results[start:start + PIPELINE_SIZE]
+                plaintexts = dehash(lookup, answers, [result['_source']['hash'] for result in chunk])
 
-                if plaintext is not None:
-                    found += 1
-                    result['_source']['password'] = plaintext
+                for result, plaintext in zip(chunk, plaintexts):
+                    if plaintext is not None:
+                        found += 1
+                        result['_source']['password'] = plaintext
 
-                total += 1
+                total += len(chunk)
 
                 current_ts = time.time()
                 delta = current_ts - ts
@@ -0,0 +1,284 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "filter.h"
+
+// One multiplier per word of a block, each picks the bit of the word from the low half of the hash prefix
+static const uint32_t filterSalts[FILTER_BLOCK_WORDS] = {0x47b6137b, 0x44974d91, 0x8824ad5b, 0xa2b7289d, 0x705495c7,
+                                                         0x2df1424b, 0x9efc4947, 0x5c6bfb31};
+
+// Returns 1 if s is not a rate strictly between 0 and 1
+int parseFalsePositiveRate(const char* s, double* rate)
+{
+    char* end;
+
+    *rate = strtod(s, &end);
+
+    return (end == s) || (*end != '\0') || !(*rate > 0) || !(*rate < 1);
+}
+
+// Expected false positive rate of a filter of blocksCount blocks holding entriesCount hash prefixes. The blocks do not
+// get the same number of prefixes: their loads follow a Poisson law, and the fuller blocks answer most false positives.
+double getFilterFalsePositiveRate(uint64_t entriesCount, uint64_t blocksCount)
+{
+    double load = (double) entriesCount / blocksCount, probability = exp(-load), rate = 0, bitSet;
+    uint64_t j, maxLoad = (uint64_t) (load + 12 * sqrt(load)) + 32;
+
+    for(j=0 ; j<=maxLoad ; j++)
+    {
+        bitSet = 1 - pow(1 - 1.0 / 64, j);
+        rate += probability * pow(bitSet, FILTER_BLOCK_WORDS);
+        probability *= load / (j + 1);
+    }
+
+    return rate;
+}
+
+// Smallest number of blocks keeping the expected false positive rate under the asked one
+uint64_t getFilterBlocksCount(uint64_t entriesCount, double falsePositiveRate)
+{
+    uint64_t l = 1, u = entriesCount + 1, m;
+
+    while(l < u)
+    {
+        m = l + (u - l) / 2;
+
+        if(getFilterFalsePositiveRate(entriesCount, m) <= falsePositiveRate)
+        {
+            u = m;
+        }
+        else
+        {
+            l = m + 1;
+        }
+    }
+
+    return l;
+}
+
+static char* getFilterPath(const char* indexPath, const char* suffix)
+{
+    char* path = malloc(strlen(indexPath) + sizeof(FILTER_FILE_SUFFIX) + strlen(suffix));
+
+    if(path != NULL)
+    {
+        sprintf(path, "%s%s%s", indexPath, FILTER_FILE_SUFFIX, suffix);
+    }
+
+    return path;
+}
+
+// Builds the filter of the hash prefixes of an index and writes it next to the index. The filter is written aside then
+// renamed, so a server never opens a partial one. Returns 1 on error.
+int writeIndexFilter(const char* indexPath, double falsePositiveRate, FilterHeader* header)
+{
+    char* path = getFilterPath(indexPath, ""), *tmpPath = getFilterPath(indexPath, FILTER_TMP_SUFFIX);
+    uint8_t padding[FILTER_HEADER_SIZE - sizeof(FilterHeader)] = {0};
+    FILE* indexFile = fopen(indexPath, "r"), *f = NULL;
+    IndexHeader indexHeader;
+    IndexFilter filter;
+    uint8_t* buffer = NULL;
+    uint8_t indexEntrySize;
+    uint64_t entriesOffset, done, readCount, i;
+    int error = (path == NULL) || (tmpPath == NULL) || (indexFile == NULL) || readIndexHeader(indexFile, &indexHeader);
+
+    filter.blocks = NULL;
+
+    if(!error)
+    {
+        indexEntrySize = getIndexEntrySize(&indexHeader);
+        entriesOffset = getIndexEntriesOffset(&indexHeader);
+
+        header->magic = FILTER_MAGIC;
+        header->entriesCount = getIndexesCount(&indexHeader);
+        header->blocksCount = getFilterBlocksCount(header->entriesCount, falsePositiveRate);
+
+        filter.header = *header;
+        filter.blocks = calloc(header->blocksCount, FILTER_BLOCK_SIZE);
+        buffer = malloc(FILTER_READ_ENTRIES * (size_t) indexEntrySize);
+        error = (filter.blocks == NULL) || (buffer == NULL);
+    }
+
+    for(done=0 ; !error && (done < header->entriesCount) ; done+=readCount)
+    {
+        readCount = (header->entriesCount - done < FILTER_READ_ENTRIES) ? header->entriesCount - done
+                                                                       : FILTER_READ_ENTRIES;
+
+        if(pread(fileno(indexFile), buffer, readCount * indexEntrySize, entriesOffset + done * indexEntrySize)
+           != (ssize_t) (readCount * indexEntrySize))
+        {
+            error = 1;
+            break;
+        }
+
+        for(i=0 ; i<readCount ; i++)
+        {
+            addFilterKey(&filter, getEntryKey(buffer + i * indexEntrySize));
+        }
+    }
+
+    if(!error)
+    {
+        f = fopen(tmpPath, "w");
+        error = (f == NULL);
+    }
+
+    if(!error)
+    {
+        error = (fwrite(header, sizeof(FilterHeader), 1, f) != 1) || (fwrite(padding, sizeof(padding), 1, f) != 1)
+                || (fwrite(filter.blocks, FILTER_BLOCK_SIZE, header->blocksCount, f) != header->blocksCount);
+        error |= fflush(f) || fsync(fileno(f));
+        error |= fclose(f);
+        error = error || rename(tmpPath, path);
+
+        if(error)
+        {
+            unlink(tmpPath);
+        }
+    }
+
+    if(indexFile != NULL)
+    {
+        fclose(indexFile);
+    }
+
+    free(filter.blocks);
+    free(buffer);
+    free(path);
+    free(tmpPath);
+
+    return error;
+}
+
+void printIndexFilterCost(FilterHeader* header)
+{
+    uint64_t size = FILTER_HEADER_SIZE + header->blocksCount * FILTER_BLOCK_SIZE;
+
+    printf("The filter takes %lu KiB (%.2f bits per entry) for %.4f%% of false positives.\n", size / 1024,
+           header->entriesCount ? 8.0 * header->blocksCount * FILTER_BLOCK_SIZE / header->entriesCount : 0,
+           100 * getFilterFalsePositiveRate(header->entriesCount, header->blocksCount));
+}
+
+// The filter of an index that goes away would be taken for the one of a new index at the same path
+void removeIndexFilter(const char* indexPath)
+{
+    char* path = getFilterPath(indexPath, "");
+
+    if(path != NULL)
+    {
+        unlink(path);
+        free(path);
+    }
+}
+
+// Opens the filter next to an index. Returns 1 if there is none, or if it is not the filter of this version of the
+// index: a filter older than its index, or built for another number of entries, is ignored.
+int openIndexFilter(const char* indexPath, uint64_t entriesCount, IndexFilter* filter)
+{
+    char* path = getFilterPath(indexPath, "");
+    struct stat indexStat, filterStat;
+
+    memset(filter, 0x00, sizeof(IndexFilter));
+    filter->fd = (path == NULL) ? -1 : open(path, O_RDONLY);
+
+    free(path);
+
+    if(filter->fd == -1)
+    {
+        return 1;
+    }
+
+    if((stat(indexPath, &indexStat) == -1) || (fstat(filter->fd, &filterStat) == -1)
+       || (pread(filter->fd, &filter->header, sizeof(FilterHeader), 0) != sizeof(FilterHeader))
+       || (filter->header.magic != FILTER_MAGIC) || (filter->header.entriesCount != entriesCount)
+       || (filter->header.blocksCount == 0)
+       || ((uint64_t) filterStat.st_size != FILTER_HEADER_SIZE + filter->header.blocksCount * FILTER_BLOCK_SIZE)
+       || (filterStat.st_mtim.tv_sec < indexStat.st_mtim.tv_sec)
+       || ((filterStat.st_mtim.tv_sec == indexStat.st_mtim.tv_sec)
+           && (filterStat.st_mtim.tv_nsec < indexStat.st_mtim.tv_nsec)))
+    {
+        closeIndexFilter(filter);
+        return 1;
+    }
+
+    return 0;
+}
+
+// The filter is small next to the index and read by every lookup, so it is faulted in whole
+int loadIndexFilter(IndexFilter* filter, int lock)
+{
+    filter->memorySize = FILTER_HEADER_SIZE + filter->header.blocksCount * FILTER_BLOCK_SIZE;
+    filter->memory = mmap(NULL, filter->memorySize, PROT_READ, MAP_SHARED | MAP_POPULATE, filter->fd, 0);
+
+    if(filter->memory == MAP_FAILED)
+    {
+        filter->memory = NULL;
+        return 1;
+    }
+
+    if(lock && (mlock(filter->memory, filter->memorySize) == -1))
+    {
+        perror("Unable to lock the filter in memory");
+    }
+
+    filter->blocks = (uint64_t*) (filter->memory + FILTER_HEADER_SIZE);
+
+    return 0;
+}
+
+void closeIndexFilter(IndexFilter* filter)
+{
+    if(filter->memory != NULL)
+    {
+        munmap(filter->memory, filter->memorySize);
+        filter->memory = NULL;
+    }
+
+    filter->blocks = NULL;
+
+    if(filter->fd != -1)
+    {
+        close(filter->fd);
+        filter->fd = -1;
+    }
+}
+
+// The high half of the prefix picks the block, so the sorted prefixes of an index fill the blocks in order
+static uint64_t* getFilterBlock(const IndexFilter* filter, uint64_t key)
+{
+    return filter->blocks + ((unsigned __int128) key * filter->header.blocksCount >> 64) * FILTER_BLOCK_WORDS;
+}
+
+void addFilterKey(IndexFilter* filter, uint64_t key)
+{
+    uint64_t* block = getFilterBlock(filter, key);
+    uint32_t i;
+
+    for(i=0 ; i<FILTER_BLOCK_WORDS ; i++)
+    {
+        block[i] |= 1ULL << (((uint32_t) key * filterSalts[i]) >> 26);
+    }
+}
+
+void prefetchFilterKey(const IndexFilter* filter, uint64_t key)
+{
+    __builtin_prefetch(getFilterBlock(filter, key));
+}
+
+// Returns 0 if the prefix is surely not in the index
+int mayContainKey(const IndexFilter* filter, uint64_t key)
+{
+    const uint64_t* block = getFilterBlock(filter, key);
+    uint64_t missing = 0;
+    uint32_t i;
+
+    for(i=0 ; i<FILTER_BLOCK_WORDS ; i++)
+    {
+        missing |= ~block[i] & (1ULL << (((uint32_t) key * filterSalts[i]) >> 26));
+    }
+
+    return missing == 0;
+}
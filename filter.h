@@ -0,0 +1,52 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "index.h"
+
+#define FILTER_MAGIC 0x3C1DDDBA // 0xBADD1D3C on little-endian platforms
+#define FILTER_FILE_SUFFIX ".filter" // The filter of an index is next to it, named after it
+#define FILTER_TMP_SUFFIX ".tmp"
+
+// A blocked Bloom filter: each hash prefix sets one bit in each of the FILTER_BLOCK_WORDS words of a single block, so a
+// check reads one cache line.
+#define FILTER_BLOCK_WORDS 8
+#define FILTER_BLOCK_SIZE (FILTER_BLOCK_WORDS * sizeof(uint64_t))
+#define FILTER_HEADER_SIZE 64 // The header is padded so the blocks of a mapped filter are aligned on cache lines
+#define FILTER_READ_ENTRIES 65536 // Index entries read at once when the filter is built
+
+typedef struct {
+    uint32_t magic;
+    uint64_t entriesCount; // Of the index, a filter of another version of the index is ignored
+    uint64_t blocksCount;
+} __attribute__((packed)) FilterHeader;
+
+typedef struct {
+    FilterHeader header;
+    uint64_t* blocks;
+    uint8_t* memory;
+    uint64_t memorySize;
+    int fd;
+} IndexFilter;
+
+int parseFalsePositiveRate(const char* s, double* rate);
+double getFilterFalsePositiveRate(uint64_t entriesCount, uint64_t blocksCount);
+uint64_t getFilterBlocksCount(uint64_t entriesCount, double falsePositiveRate);
+
+int writeIndexFilter(const char* indexPath, double falsePositiveRate, FilterHeader* header);
+void printIndexFilterCost(FilterHeader* header);
+void removeIndexFilter(const char* indexPath);
+
+int openIndexFilter(const char* indexPath, uint64_t entriesCount, IndexFilter* filter);
+int loadIndexFilter(IndexFilter* filter, int lock);
+void closeIndexFilter(IndexFilter* filter);
+
+void addFilterKey(IndexFilter* filter, uint64_t key);
+void prefetchFilterKey(const IndexFilter* filter, uint64_t key);
+int mayContainKey(const IndexFilter* filter, uint64_t key);
+
+#endif //FILTER_H
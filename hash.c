@@ -5,18 +5,21 @@ void getHashInfos(const char* hashName, HashInfos* out)
     if(strncmp(hashName, "md5", 3) == 0)
     {
         out->f = MD5;
+        out->batch = md5Batch;
         out->digestSize = MD5_DIGEST_LENGTH;
     }
 
     if(strncmp(hashName, "sha1", 3) == 0)
     {
         out->f = SHA1;
+        out->batch = sha1Batch;
         out->digestSize = SHA_DIGEST_LENGTH;
     }
 
     if(strncmp(hashName, "sha256", 6) == 0)
     {
         out->f = SHA256;
+        out->batch = sha256Batch;
         out->digestSize = SHA256_DIGEST_LENGTH;
     }
 }
\ No newline at end of file
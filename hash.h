@@ -6,8 +6,15 @@
 #include <openssl/md5.h>
 #include <openssl/sha.h>
 
+#include "multihash.h"
+
+#define MAX_DIGEST_SIZE SHA256_DIGEST_LENGTH
+#define HASH_BATCH_SIZE 64
+
 typedef struct {
     unsigned char* (*f)(const unsigned char*, size_t, unsigned char*);
+    // Hashes count words at once and writes their digests back to back in digests
+    void (*batch)(const unsigned char* const* words, const size_t* lengths, size_t count, unsigned char* digests);
     unsigned char digestSize;
 } HashInfos;
 
@@ -1,15 +1,19 @@
 #include "index.h"
 
-uint8_t getMinDataBits(FILE* wordlist)
+uint8_t getMinDataBits(uint64_t wordlistSize)
 {
-    uint64_t wordlistSize = getFileSize(wordlist);
+    // Without any word in the wordlist (all of them inline), there is no pointer to fit
+    if(wordlistSize == 0)
+    {
+        return MIN_DATA_BITS;
+    }
 
     return MIN_DATA_BITS + (uint8_t) ceil(log2((double) wordlistSize));
 }
 
-int isDataSizeValid(FILE* wordlist, uint8_t bits)
+int isDataSizeValid(uint64_t wordlistSize, uint8_t bits)
 {
-    return (bits >= getMinDataBits(wordlist)) && (bits <= MAX_DATA_BITS);
+    return (bits >= getMinDataBits(wordlistSize)) && (bits <= MAX_DATA_BITS);
 }
 
 uint8_t getIndexEntrySize(IndexHeader* header)
@@ -31,9 +35,29 @@ int64_t getIndexesCount(IndexHeader* header)
     return (int64_t) (indexesSize / indexSize);
 }
 
+// Hash prefix of an entry read as a big-endian integer, so the keys order matches memcmp
+uint64_t getEntryKey(const uint8_t* entry)
+{
+    uint64_t key = 0;
+    uint32_t i;
+
+    for(i=0 ; i<INDEX_HASH_SIZE ; i++)
+    {
+        key = (key << 8) | entry[i];
+    }
+
+    return key;
+}
+
+// Position of the entries in the file, wordlistOffset is relative to it
+uint64_t getIndexEntriesOffset(IndexHeader* header)
+{
+    return sizeof(IndexHeader) + ((header->magic == INDEX_MAGIC_DIRECTORY) ? INDEX_DIRECTORY_SIZE : 0);
+}
+
 uint64_t getPointerFromData(uint8_t* data, uint8_t dataBytes)
 {
-    uint64_t pointer;
+    uint64_t pointer = 0;
 
     if (dataBytes > 8)
     {
@@ -53,11 +77,61 @@ uint64_t getPointerFromData(uint8_t* data, uint8_t dataBytes)
     return pointer;
 }
 
+// Decodes the word of an entry, inline or pointed in the wordlist region, as a NUL-terminated string
+void readWord(uint8_t* indexData, uint8_t* wordlist, uint8_t indexDataSize, uint8_t* out)
+{
+    uint8_t* word = indexData;
+    uint8_t lastByte = indexData[indexDataSize - 1];
+
+    if(!(lastByte & INLINE_WORD_MASK))
+    {
+        word = wordlist + getPointerFromData(indexData, indexDataSize);
+    }
+
+    switch((lastByte & WORD_TYPE_MASK) >> INLINE_WORD_BITS)
+    {
+        case NUMERIC:
+            uncompressNumeric(word, out);
+            break;
+
+        case ALPHANUMERIC:
+            uncompressAlphanumeric(word, out);
+            break;
+
+        case REDUCED_ASCII:
+            uncompressReducedASCII(word, out);
+            break;
+
+        default:
+            strcpy((char*) out, (char*) word);
+            break;
+    }
+}
+
+// Size of a word stored in the wordlist region, from its type and its decoded length
+uint64_t getStoredWordSize(WordType wordType, size_t length)
+{
+    switch(wordType)
+    {
+        case NUMERIC:
+            return BYTES_SIZE(NUMERIC_COMPRESSED_BITS(length) + NUMERIC_SYMBOL_BITS);
+
+        case ALPHANUMERIC:
+            return BYTES_SIZE(ALPHANUMERIC_COMPRESSED_BITS(length) + ALPHANUMERIC_SYMBOL_BITS);
+
+        case REDUCED_ASCII:
+            return BYTES_SIZE(REDUCED_ASCII_COMPRESSED_BITS(length) + REDUCED_ASCII_SYMBOL_BITS);
+
+        default:
+            return length + 1;
+    }
+}
+
 int readIndexHeader(FILE* in, IndexHeader* header)
 {
     fread(header, sizeof(IndexHeader), 1, in);
 
-    if(header->magic != INDEX_MAGIC)
+    if((header->magic != INDEX_MAGIC) && (header->magic != INDEX_MAGIC_DIRECTORY))
     {
         return 1;
     }
@@ -65,9 +139,8 @@ int readIndexHeader(FILE* in, IndexHeader* header)
     return getIndexesCount(header) == 0;
 }
 
-int writeIndexHeader(FILE* out, char* hashName, uint8_t dataBytes, uint64_t wordlistOffset)
+int writeIndexHeader(FILE* out, uint32_t magic, char* hashName, uint8_t dataBytes, uint64_t wordlistOffset)
 {
-    uint32_t magic = INDEX_MAGIC;
     uint8_t hashNameLength = strlen(hashName);
     uint8_t hashNameBuf[MAX_HASH_NAME_SIZE] = {0};
 
@@ -82,68 +155,199 @@ int writeIndexHeader(FILE* out, char* hashName, uint8_t dataBytes, uint64_t word
     fwrite(hashNameBuf, sizeof(uint8_t), MAX_HASH_NAME_SIZE, out);
     fwrite(&dataBytes, sizeof(uint8_t), 1, out);
     fwrite(&wordlistOffset, sizeof(uint64_t), 1, out);
+
+    return 0;
+}
+
+// Writes an empty directory after the header, it is filled by updateIndexDirectory once the entries are sorted
+int reserveIndexDirectory(FILE* out)
+{
+    uint64_t directory[INDEX_DIRECTORY_BUCKETS + 1] = {0};
+
+    return fwrite(directory, sizeof(directory), 1, out) != 1;
 }
 
-void writeIndexEntryInline(const uint8_t* hash, const uint8_t* data, size_t compressedDataBits, size_t dataBytes, WordType wordType, FILE* output)
+// An empty or stale directory does not end with the entries count
+int isIndexDirectoryValid(IndexHeader* header, const uint64_t* directory)
+{
+    return (header->magic == INDEX_MAGIC_DIRECTORY)
+           && (directory[INDEX_DIRECTORY_BUCKETS] == (uint64_t) getIndexesCount(header));
+}
+
+// Position of the first entry of the sorted index whose top hash bits are not below bucket, searched from first
+static uint64_t findDirectoryBucket(int fd, IndexHeader* header, uint64_t first, uint64_t bucket)
+{
+    uint8_t entry[INDEX_HASH_SIZE];
+    uint64_t l = first, u = getIndexesCount(header), m;
+
+    while(l < u)
+    {
+        m = l + (u - l) / 2;
+
+        if(pread(fd, entry, INDEX_HASH_SIZE, getIndexEntriesOffset(header) + m * getIndexEntrySize(header))
+           != INDEX_HASH_SIZE)
+        {
+            return u;
+        }
+
+        if((getEntryKey(entry) >> (64 - INDEX_DIRECTORY_BITS)) < bucket)
+        {
+            l = m + 1;
+        }
+        else
+        {
+            u = m;
+        }
+    }
+
+    return l;
+}
+
+// Fills the directory of a sorted index from its entries. Indexes without a directory section are left as is.
+int updateIndexDirectory(FILE* indexFile)
+{
+    IndexHeader header;
+    uint64_t* directory;
+    uint64_t bucket;
+    int error;
+
+    if(fflush(indexFile) || (pread(fileno(indexFile), &header, sizeof(IndexHeader), 0) != sizeof(IndexHeader)))
+    {
+        return 1;
+    }
+
+    if(header.magic != INDEX_MAGIC_DIRECTORY)
+    {
+        return 0;
+    }
+
+    directory = malloc(INDEX_DIRECTORY_SIZE);
+
+    if(directory == NULL)
+    {
+        return 1;
+    }
+
+    directory[0] = 0;
+
+    for(bucket=1 ; bucket<INDEX_DIRECTORY_BUCKETS ; bucket++)
+    {
+        directory[bucket] = findDirectoryBucket(fileno(indexFile), &header, directory[bucket - 1], bucket);
+    }
+
+    directory[INDEX_DIRECTORY_BUCKETS] = getIndexesCount(&header);
+
+    error = pwrite(fileno(indexFile), directory, INDEX_DIRECTORY_SIZE, sizeof(IndexHeader)) != INDEX_DIRECTORY_SIZE;
+
+    free(directory);
+
+    return error;
+}
+
+void encodeIndexEntryInline(const uint8_t* hash, const uint8_t* data, size_t compressedDataBits, size_t dataBytes, WordType wordType, uint8_t* out)
 {
     size_t compressedDataBytes = BYTES_SIZE(compressedDataBits);
     size_t paddingBytes = dataBytes - compressedDataBytes;
     uint8_t lastByte = (wordType << 1) | 1;
-    uint64_t padding = 0L;
 
-    fwrite(hash, sizeof(uint8_t), INDEX_HASH_SIZE, output);
+    memcpy(out, hash, INDEX_HASH_SIZE);
+    out += INDEX_HASH_SIZE;
 
-    if(paddingBytes > 1)
+    if(paddingBytes > 0)
     {
-        fwrite(data, sizeof(uint8_t), compressedDataBytes, output);
-        fwrite((uint8_t*) &padding, sizeof(uint8_t), paddingBytes - 1, output);
-        fwrite(&lastByte, sizeof(uint8_t), 1, output);
-    }
-    else if(paddingBytes == 1)
-    {
-        fwrite(data, sizeof(uint8_t), compressedDataBytes, output);
-        fwrite(&lastByte, sizeof(uint8_t), 1, output);
+        memcpy(out, data, compressedDataBytes);
+        memset(out + compressedDataBytes, 0x00, paddingBytes - 1);
     }
     else
     {
         // In this case the last data byte must have at least 3 bits set to 0
         lastByte |= data[dataBytes - 1];
 
-        fwrite(data, sizeof(uint8_t), compressedDataBytes - 1, output);
-        fwrite(&lastByte, sizeof(uint8_t), 1, output);
+        memcpy(out, data, compressedDataBytes - 1);
     }
+
+    out[dataBytes - 1] = lastByte;
 }
 
-void writeIndexEntryPointer(const uint8_t* hash, uint64_t wordPointer, size_t dataBytes, WordType wordType, FILE* output)
+void encodeIndexEntryPointer(const uint8_t* hash, uint64_t wordPointer, size_t dataBytes, WordType wordType, uint8_t* out)
 {
     uint8_t i, lastByte = wordType << 1;
     size_t compressedDataBytes, paddingBytes;
-    uint64_t padding = 0L;
 
     for(i=0 ; (wordPointer >> i) != 0 ; i++);
 
     compressedDataBytes = BYTES_SIZE(i);
     paddingBytes = dataBytes - compressedDataBytes;
 
-    fwrite(hash, sizeof(uint8_t), INDEX_HASH_SIZE, output);
+    memcpy(out, hash, INDEX_HASH_SIZE);
+    out += INDEX_HASH_SIZE;
 
-    if(paddingBytes > 1)
+    if(paddingBytes > 0)
     {
-        fwrite(&wordPointer, sizeof(uint8_t), compressedDataBytes, output);
-        fwrite((uint8_t*) &padding, sizeof(uint8_t), paddingBytes - 1, output);
-        fwrite(&lastByte, sizeof(uint8_t), 1, output);
-    }
-    else if(paddingBytes == 1)
-    {
-        fwrite(&wordPointer, sizeof(uint8_t), compressedDataBytes, output);
-        fwrite(&lastByte, sizeof(uint8_t), 1, output);
+        memcpy(out, &wordPointer, compressedDataBytes);
+        memset(out + compressedDataBytes, 0x00, paddingBytes - 1);
     }
     else
     {
         // In this case the last data byte must have at least 3 bits set to 0
         lastByte |= (wordPointer >> ((compressedDataBytes - 1) << 3));
 
-        fwrite(&wordPointer, sizeof(uint8_t), compressedDataBytes - 1, output);
-        fwrite(&lastByte, sizeof(uint8_t), 1, output);
+        memcpy(out, &wordPointer, compressedDataBytes - 1);
+    }
+
+    out[dataBytes - 1] = lastByte;
+}
+
+void initEntryWriter(EntryWriter* writer, uint8_t* buffer, size_t size, FILE* output)
+{
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->used = 0;
+    writer->output = output;
+}
+
+// Returns where the next entry must be encoded, flushing the buffer first if it is full.
+uint8_t* reserveIndexEntry(EntryWriter* writer, size_t entrySize)
+{
+    uint8_t* entry;
+
+    if((writer->used + entrySize > writer->size) && (writer->output != NULL))
+    {
+        flushEntryWriter(writer);
     }
-}
\ No newline at end of file
+
+    entry = writer->buffer + writer->used;
+    writer->used += entrySize;
+
+    return entry;
+}
+
+int flushEntryWriter(EntryWriter* writer)
+{
+    size_t used = writer->used;
+
+    if(writer->output == NULL)
+    {
+        return 0;
+    }
+
+    writer->used = 0;
+
+    return (used != 0) && (fwrite(writer->buffer, used, 1, writer->output) != 1);
+}
+
+void writeIndexEntry(const uint8_t* entry, size_t entrySize, EntryWriter* output)
+{
+    memcpy(reserveIndexEntry(output, entrySize), entry, entrySize);
+}
+
+void writeIndexEntryInline(const uint8_t* hash, const uint8_t* data, size_t compressedDataBits, size_t dataBytes, WordType wordType, EntryWriter* output)
+{
+    encodeIndexEntryInline(hash, data, compressedDataBits, dataBytes, wordType,
+                           reserveIndexEntry(output, INDEX_HASH_SIZE + dataBytes));
+}
+
+void writeIndexEntryPointer(const uint8_t* hash, uint64_t wordPointer, size_t dataBytes, WordType wordType, EntryWriter* output)
+{
+    encodeIndexEntryPointer(hash, wordPointer, dataBytes, wordType, reserveIndexEntry(output, INDEX_HASH_SIZE + dataBytes));
+}
@@ -3,10 +3,19 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include <math.h>
 #include "utils.h"
 
 #define INDEX_MAGIC 0x3A1DDDBA // 0xBADD1D3A on little-endian platforms
+#define INDEX_MAGIC_DIRECTORY 0x3B1DDDBA // Index with a directory section between the header and the entries
+
+// The directory holds the position of the first entry of each value of the top hash bits, plus the entries count.
+// 2^16 buckets take 512 KiB and stay in L2/L3.
+#define INDEX_DIRECTORY_BITS 16
+#define INDEX_DIRECTORY_BUCKETS (1 << INDEX_DIRECTORY_BITS)
+#define INDEX_DIRECTORY_SIZE ((INDEX_DIRECTORY_BUCKETS + 1) * sizeof(uint64_t))
 
 #define INDEX_HASH_SIZE 8
 #define MAX_DATA_SIZE 16
@@ -31,6 +40,15 @@ typedef enum {
     REDUCED_ASCII = 3
 } WordType;
 
+// Entries are encoded into buffer and written to output each time it is full. A writer without output (e.g. over a
+// mapped file) must be given a buffer large enough for all its entries.
+typedef struct {
+    uint8_t* buffer;
+    size_t size;
+    size_t used;
+    FILE* output;
+} EntryWriter;
+
 typedef struct {
     uint32_t magic;
     char hashName[MAX_HASH_NAME_SIZE];
@@ -38,16 +56,32 @@ typedef struct {
     uint64_t wordlistOffset;
 } __attribute__((packed)) IndexHeader;
 
-uint8_t getMinDataBits(FILE* wordlist);
-int isDataSizeValid(FILE* wordlist, uint8_t bits);
+uint8_t getMinDataBits(uint64_t wordlistSize);
+int isDataSizeValid(uint64_t wordlistSize, uint8_t bits);
 uint8_t getIndexEntrySize(IndexHeader* header);
 int64_t getIndexesCount(IndexHeader* header);
+uint64_t getEntryKey(const uint8_t* entry);
+uint64_t getIndexEntriesOffset(IndexHeader* header);
 uint64_t getPointerFromData(uint8_t* data, uint8_t dataBytes);
+void readWord(uint8_t* indexData, uint8_t* wordlist, uint8_t indexDataSize, uint8_t* out);
+uint64_t getStoredWordSize(WordType wordType, size_t length);
 
 int readIndexHeader(FILE* in, IndexHeader* header);
-int writeIndexHeader(FILE* out, char* hashName, uint8_t dataBytes, uint64_t wordlistOffset);
+int writeIndexHeader(FILE* out, uint32_t magic, char* hashName, uint8_t dataBytes, uint64_t wordlistOffset);
+
+int reserveIndexDirectory(FILE* out);
+int isIndexDirectoryValid(IndexHeader* header, const uint64_t* directory);
+int updateIndexDirectory(FILE* indexFile);
+
+void encodeIndexEntryInline(const uint8_t* hash, const uint8_t* data, size_t compressedDataBits, size_t dataBytes, WordType wordType, uint8_t* out);
+void encodeIndexEntryPointer(const uint8_t* hash, uint64_t wordPointer, size_t dataBytes, WordType wordType, uint8_t* out);
+
+void initEntryWriter(EntryWriter* writer, uint8_t* buffer, size_t size, FILE* output);
+uint8_t* reserveIndexEntry(EntryWriter* writer, size_t entrySize);
+int flushEntryWriter(EntryWriter* writer);
 
-void writeIndexEntryInline(const uint8_t* hash, const uint8_t* data, size_t compressedDataBits, size_t dataBytes, WordType wordType, FILE* output);
-void writeIndexEntryPointer(const uint8_t* hash, uint64_t wordPointer, size_t dataBytes, WordType wordType, FILE* output);
+void writeIndexEntry(const uint8_t* entry, size_t entrySize, EntryWriter* output);
+void writeIndexEntryInline(const uint8_t* hash, const uint8_t* data, size_t compressedDataBits, size_t dataBytes, WordType wordType, EntryWriter* output);
+void writeIndexEntryPointer(const uint8_t* hash, uint64_t wordPointer, size_t dataBytes, WordType wordType, EntryWriter* output);
 
 #endif //INDEX_H
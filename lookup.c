@@ -3,379 +3,1077 @@
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <netinet/in.h>
-#include <signal.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
-#include <sys/wait.h>
-#include <poll.h>
 
 #include "utils.h"
 #include "index.h"
 #include "hash.h"
+#include "table.h"
+#include "segments.h"
 #include "defines.h"
 
-#define UNUSED(x) (void)(x)
+#define MAX_EVENTS 256
+#define CLIENT_BUFFER_SIZE (16 * 1024) // Pipelined requests read at once from a client
+#define REQUESTS_BATCH_SIZE 256 // Requests looked up together by an event loop
+#define MAX_TABLES 8 // Indexes served by one process
+#define LOOPS_CHECK_INTERVAL 1 // Seconds between two checks of the running event loops, when no reload is asked
+#define RELOAD_POLL_INTERVAL 1000 // Microseconds between two checks of the event loops still using the old indexes
+#define PROTOCOL_UNKNOWN 0
+#define PROTOCOL_TEXT 1
+#define PROTOCOL_BINARY 2
+#define BINARY_MAGIC "\0BIN" // Opens a binary connection, a text request never starts with a 0
+#define BINARY_NAMED_MAGIC "\0BIH" // Same, followed by the NUL-padded name of the hash function of the index to query
+#define BINARY_MAGIC_SIZE 4
+#define BINARY_COUNT_SIZE 4
+#define BINARY_LENGTH_SIZE 2
+#define BINARY_MISS 0xFFFF // Answer length of a digest missing from the index
+
+// The indexes served at a time. On SIGHUP they are opened and loaded again from their paths while the current ones are
+// still served, then swapped in. The old ones are closed once no event loop uses them anymore.
+typedef struct {
+    SegmentedIndex tables[MAX_TABLES];
+    uint32_t tablesCount;
+} IndexSet;
 
 typedef struct {
-    uint8_t indexEntrySize;
-    uint8_t indexDataSize;
-    int64_t indexesCount;
-    HashInfos hashInfos;
-    uint8_t* index;
-    uint8_t* wordlist;
+    IndexSet* volatile indexes;
+    const char* paths[MAX_TABLES];
+    uint32_t pathsCount;
+    uint32_t tableFlags;
+    uint16_t port;
+    uint32_t maxClients;
+    uint32_t clientsCount;
+    uint32_t runningLoops;
 } SharedParameters;
 
-static uint32_t childrenRunning = 0;
+// A client of an event loop. Every request is a hex digest ended by a new line, and gets the word (empty when not
+// found) ended by a new line, in the requests order. The answers not sent yet are kept until the socket is writable
+// again, and the client is not read meanwhile. An empty line closes the connection once the previous requests are
+// answered. A request goes to the first index of its digest size, or to the index of the hash function named by a tag:
+// "<hash name>:<hex digest>".
+// A client that opens with BINARY_MAGIC speaks the binary protocol instead with the first index, or with the index of
+// the hash function named after BINARY_NAMED_MAGIC. It is acknowledged by BINARY_MAGIC and the digest size of the
+// index. Its requests are frames of a 32 bits little-endian count followed by as many raw digests, and every digest
+// gets a 16 bits little-endian length followed by the word, or BINARY_MISS alone when not found. An empty frame
+// closes the connection once the previous requests are answered.
+typedef struct {
+    int fd;
+    int protocol;
+    int closing;
+    int failed;
+    int queued;
+    uint32_t table;
+    uint32_t frameLeft;
+    size_t inLength;
+    char in[CLIENT_BUFFER_SIZE];
+    uint8_t* out;
+    size_t outSize;
+    size_t outLength;
+    size_t outSent;
+} Client;
+
+// The requests of a batch going to one index, in the batch order
+typedef struct {
+    uint32_t count;
+    uint8_t* digests;
+    uint8_t* outs[REQUESTS_BATCH_SIZE];
+    size_t lengths[REQUESTS_BATCH_SIZE];
+} TableBatch;
+
+// The requests of the ready clients are collected in a batch, looked up once it is full or once the events are
+// handled. Each index looks its own requests up, then the answers are sent back in the batch order. The clients with
+// new answers are queued to be flushed after the events.
+typedef struct {
+    SharedParameters* params;
+    IndexSet* volatile indexes; // The indexes used while handling events, NULL while waiting for them
+    int server;
+    int epoll;
+    uint32_t requestsCount;
+    Client* requestClients[REQUESTS_BATCH_SIZE];
+    int validRequests[REQUESTS_BATCH_SIZE];
+    uint32_t requestTables[REQUESTS_BATCH_SIZE];
+    uint32_t requestPositions[REQUESTS_BATCH_SIZE];
+    TableBatch batches[MAX_TABLES];
+    uint8_t* results;
+    uint8_t* digestTmp;
+    uint32_t queuedCount;
+    Client* queuedClients[MAX_EVENTS];
+} EventLoop;
+
+void closeClient(EventLoop* loop, Client* client)
+{
+    epoll_ctl(loop->epoll, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    free(client->out);
+    free(client);
+
+    __sync_fetch_and_sub(&loop->params->clientsCount, 1);
+}
+
+// Sends what is left of the answers. Returns -1 on error, 1 if the socket is full.
+int flushClient(Client* client)
+{
+    ssize_t sent;
+
+    while(client->outSent < client->outLength)
+    {
+        sent = send(client->fd, client->out + client->outSent, client->outLength - client->outSent, MSG_NOSIGNAL);
+
+        if(sent < 0)
+        {
+            return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 1 : -1;
+        }
+
+        client->outSent += sent;
+    }
+
+    client->outLength = 0;
+    client->outSent = 0;
+
+    return 0;
+}
+
+int waitClient(EventLoop* loop, Client* client, uint32_t events)
+{
+    struct epoll_event event;
+
+    event.events = events;
+    event.data.ptr = client;
+
+    return epoll_ctl(loop->epoll, EPOLL_CTL_MOD, client->fd, &event);
+}
 
-void childTerminated(int sig)
+int appendOutput(Client* client, const uint8_t* data, size_t length)
 {
-    UNUSED(sig);
+    size_t outSize = client->outSize;
+    uint8_t* out;
 
-    pid_t pid;
+    while(client->outLength + length > outSize)
+    {
+        outSize *= 2;
+    }
 
-    do {
-        pid = waitpid((pid_t) -1, NULL, WNOHANG);
+    if(outSize != client->outSize)
+    {
+        out = realloc(client->out, outSize);
 
-        if(pid > 0)
+        if(out == NULL)
         {
-            childrenRunning--;
+            return 1;
         }
-    } while (pid > 0);
+
+        client->out = out;
+        client->outSize = outSize;
+    }
+
+    memcpy(client->out + client->outLength, data, length);
+    client->outLength += length;
+
+    return 0;
 }
 
-void readWord(uint8_t* indexData, uint8_t* wordlist, uint8_t indexDataSize, uint8_t* out)
+int appendBinaryAnswer(Client* client, const uint8_t* word, size_t length)
 {
-    uint8_t* word = indexData;
-    uint8_t lastByte = indexData[indexDataSize - 1];
+    uint16_t answerLength = (length == LOOKUP_NOT_FOUND) ? BINARY_MISS : length;
+    uint8_t header[BINARY_LENGTH_SIZE] = {answerLength & 0xFF, answerLength >> 8};
 
-    if(!(lastByte & INLINE_WORD_MASK))
+    return appendOutput(client, header, BINARY_LENGTH_SIZE)
+           || ((length != LOOKUP_NOT_FOUND) && appendOutput(client, word, length));
+}
+
+// Looks the batch up and appends the answers to their clients
+void resolveRequests(EventLoop* loop)
+{
+    TableBatch* batch;
+    Client* client;
+    uint8_t* out;
+    size_t length;
+    uint32_t i;
+    int ret;
+
+    for(i=0 ; i<loop->indexes->tablesCount ; i++)
     {
-        word = wordlist + getPointerFromData(indexData, indexDataSize);
+        batch = &loop->batches[i];
+
+        if(batch->count > 0)
+        {
+            lookupSegmentsBatch(&loop->indexes->tables[i], loop->digestTmp, batch->digests, batch->count, batch->outs,
+                                batch->lengths);
+            batch->count = 0;
+        }
     }
 
-    switch((lastByte & WORD_TYPE_MASK) >> INLINE_WORD_BITS)
+    for(i=0 ; i<loop->requestsCount ; i++)
     {
-        case NUMERIC:
-            uncompressNumeric(word, out);
-            break;
+        client = loop->requestClients[i];
+        batch = &loop->batches[loop->requestTables[i]];
+        out = batch->outs[loop->requestPositions[i]];
+        length = batch->lengths[loop->requestPositions[i]];
 
-        case ALPHANUMERIC:
-            uncompressAlphanumeric(word, out);
-            break;
+        if(client->protocol == PROTOCOL_BINARY)
+        {
+            ret = appendBinaryAnswer(client, out, length);
+        }
+        else
+        {
+            length = (loop->validRequests[i] && (length != LOOKUP_NOT_FOUND)) ? length : 0;
+            out[length] = '\n';
+            ret = appendOutput(client, out, length + 1);
+        }
 
-        case REDUCED_ASCII:
-            uncompressReducedASCII(word, out);
-            break;
+        if(ret)
+        {
+            client->failed = 1;
+        }
+    }
+
+    loop->requestsCount = 0;
+}
+
+// The client is flushed after the events
+void queueClient(EventLoop* loop, Client* client)
+{
+    if(!client->queued)
+    {
+        client->queued = 1;
+        loop->queuedClients[loop->queuedCount++] = client;
+    }
+}
 
-        default:
-            strcpy((char*) out, (char*) word);
+// Adds a request of the client for an index to the batch, and returns where its digest goes
+uint8_t* queueRequest(EventLoop* loop, Client* client, uint32_t table, int valid)
+{
+    TableBatch* batch = &loop->batches[table];
+    uint32_t request;
+
+    if(loop->requestsCount == REQUESTS_BATCH_SIZE)
+    {
+        resolveRequests(loop);
+    }
+
+    request = loop->requestsCount++;
+    loop->validRequests[request] = valid;
+    loop->requestClients[request] = client;
+    loop->requestTables[request] = table;
+    loop->requestPositions[request] = batch->count;
+    batch->outs[batch->count] = loop->results + request * (MAX_LINE_SIZE + 1);
+    queueClient(loop, client);
+
+    return batch->digests + batch->count++ * loop->indexes->tables[table].hashInfos.digestSize;
+}
+
+// Returns the index of the hash function named by the first nameLength bytes of name, tablesCount if none is loaded
+uint32_t findTable(IndexSet* indexes, const char* name, size_t nameLength)
+{
+    uint32_t i;
+
+    for(i=0 ; i<indexes->tablesCount ; i++)
+    {
+        if((strnlen(indexes->tables[i].hashName, MAX_HASH_NAME_SIZE) == nameLength)
+           && (memcmp(indexes->tables[i].hashName, name, nameLength) == 0))
+        {
             break;
+        }
     }
+
+    return i;
 }
 
-void lookup(uint8_t* index, uint8_t* wordlist, int64_t indexesCount, uint8_t indexEntrySize, uint8_t indexDataSize,
-            HashInfos* hashInfos, uint8_t* digestTmp, uint8_t* hash, uint8_t* out, size_t* outlen)
+// Returns the index of a text request and strips its tag, tablesCount if no index matches
+uint32_t routeRequest(IndexSet* indexes, char** line, size_t* length)
 {
-    int64_t l = 0, u = indexesCount - 1, m;
-    int cmp;
+    char* separator = memchr(*line, ':', *length);
+    uint32_t i;
 
-    *outlen = 0;
+    if(separator != NULL)
+    {
+        *length -= separator + 1 - *line;
+        i = findTable(indexes, *line, separator - *line);
+        *line = separator + 1;
+
+        return i;
+    }
 
-    while(u >= l)
+    for(i=0 ; i<indexes->tablesCount ; i++)
     {
-        m = l + (u - l) / 2;
-        cmp = memcmp(index + m * indexEntrySize, hash, INDEX_HASH_SIZE);
+        if(*length == 2 * (size_t) indexes->tables[i].hashInfos.digestSize)
+        {
+            break;
+        }
+    }
+
+    return i;
+}
 
-        if(cmp > 0)
+// Queues the complete lines of the buffer, and returns the number of bytes read
+size_t parseTextRequests(EventLoop* loop, Client* client, char* in, size_t inLength)
+{
+    IndexSet* indexes = loop->indexes;
+    char* line = in, *end, *request;
+    size_t length, digestSize;
+    uint8_t* digest;
+    uint32_t table;
+
+    while(!client->closing && ((end = memchr(line, '\n', in + inLength - line)) != NULL))
+    {
+        length = end - line;
+
+        if((length > 0) && (line[length - 1] == '\r'))
         {
-            u = m - 1;
+            length--;
         }
-        else if(cmp < 0)
+
+        if(length == 0)
         {
-            l = m + 1;
+            client->closing = 1;
         }
         else
         {
-            while((m >= 0) && (memcmp(index + m * indexEntrySize, hash, INDEX_HASH_SIZE) == 0))
+            request = line;
+            table = routeRequest(indexes, &request, &length);
+
+            // A malformed digest is answered as not found by the first index, to keep the answers in order
+            if(table == indexes->tablesCount)
             {
-                m--;
+                table = 0;
+                length = 0;
             }
 
-            m++;
+            digestSize = indexes->tables[table].hashInfos.digestSize;
+            digest = queueRequest(loop, client, table, length == 2 * digestSize);
 
-            while((m < indexesCount) && (memcmp(index + m * indexEntrySize, hash, INDEX_HASH_SIZE) == 0))
+            if(length == 2 * digestSize)
             {
-                readWord(index + m * indexEntrySize + INDEX_HASH_SIZE, wordlist, indexDataSize, out);
-                *outlen = strlen((char*) out);
-                hashInfos->f(out, *outlen, digestTmp);
+                unhex(request, digest, digestSize);
+            }
+            else
+            {
+                memset(digest, 0x00, digestSize);
+            }
+        }
 
-                if(memcmp(hash, digestTmp, hashInfos->digestSize) == 0)
-                {
-                    return;
-                }
+        line = end + 1;
+    }
+
+    return line - in;
+}
+
+// Queues the complete digests of the buffer, and returns the number of bytes read
+size_t parseBinaryRequests(EventLoop* loop, Client* client, const uint8_t* in, size_t inLength)
+{
+    size_t digestSize = loop->indexes->tables[client->table].hashInfos.digestSize, position = 0;
+
+    while(!client->closing)
+    {
+        if((client->frameLeft > 0) && (inLength - position >= digestSize))
+        {
+            memcpy(queueRequest(loop, client, client->table, 1), in + position, digestSize);
+            position += digestSize;
+            client->frameLeft--;
+        }
+        else if((client->frameLeft == 0) && (inLength - position >= BINARY_COUNT_SIZE))
+        {
+            client->frameLeft = in[position] | (in[position + 1] << 8) | ((uint32_t) in[position + 2] << 16)
+                                | ((uint32_t) in[position + 3] << 24);
+            client->closing = (client->frameLeft == 0);
+            position += BINARY_COUNT_SIZE;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    return position;
+}
+
+// Picks the protocol of the client from its first bytes, then queues the complete requests read so far. Returns 1 if
+// a request does not fit in the read buffer or if the client opens with something else than a binary magic.
+int parseRequests(EventLoop* loop, Client* client)
+{
+    uint8_t acknowledgement[BINARY_MAGIC_SIZE + 1];
+    size_t position = 0;
+
+    if(client->protocol == PROTOCOL_UNKNOWN)
+    {
+        if(client->in[0] != '\0')
+        {
+            client->protocol = PROTOCOL_TEXT;
+        }
+        else if((client->inLength < BINARY_MAGIC_SIZE)
+                || ((memcmp(client->in, BINARY_NAMED_MAGIC, BINARY_MAGIC_SIZE) == 0)
+                    && (client->inLength < BINARY_MAGIC_SIZE + MAX_HASH_NAME_SIZE)))
+        {
+            return 0;
+        }
+        else
+        {
+            if(memcmp(client->in, BINARY_MAGIC, BINARY_MAGIC_SIZE) == 0)
+            {
+                client->table = 0;
+                position = BINARY_MAGIC_SIZE;
+            }
+            else if(memcmp(client->in, BINARY_NAMED_MAGIC, BINARY_MAGIC_SIZE) == 0)
+            {
+                client->table = findTable(loop->indexes, client->in + BINARY_MAGIC_SIZE,
+                                          strnlen(client->in + BINARY_MAGIC_SIZE, MAX_HASH_NAME_SIZE));
+                position = BINARY_MAGIC_SIZE + MAX_HASH_NAME_SIZE;
+            }
+            else
+            {
+                return 1;
+            }
 
-                *outlen = 0;
-                m++;
+            if(client->table == loop->indexes->tablesCount)
+            {
+                return 1;
             }
 
-            return;
+            memcpy(acknowledgement, BINARY_MAGIC, BINARY_MAGIC_SIZE);
+            acknowledgement[BINARY_MAGIC_SIZE] = loop->indexes->tables[client->table].hashInfos.digestSize;
+
+            if(appendOutput(client, acknowledgement, sizeof(acknowledgement)))
+            {
+                return 1;
+            }
+
+            queueClient(loop, client);
+            client->protocol = PROTOCOL_BINARY;
         }
     }
+
+    if(client->protocol == PROTOCOL_BINARY)
+    {
+        position += parseBinaryRequests(loop, client, (uint8_t*) client->in + position, client->inLength - position);
+    }
+    else
+    {
+        position += parseTextRequests(loop, client, client->in, client->inLength);
+    }
+
+    client->inLength -= position;
+    memmove(client->in, client->in + position, client->inLength);
+
+    return client->inLength == CLIENT_BUFFER_SIZE;
 }
 
-int handleClient(int client, SharedParameters* params)
+// Reads the requests of a ready client, or sends the rest of its answers. Returns 1 when the client must be closed.
+int handleClient(EventLoop* loop, Client* client, uint32_t events)
 {
-    uint8_t lookupResult[MAX_LINE_SIZE];
-    char line[MAX_LINE_SIZE];
-    size_t lookupResultLen;
-    uint8_t* digest, *digestTmp;
     ssize_t readCount;
-    struct pollfd fds[1];
-    int pollret;
+    int ret;
+
+    if(events & (EPOLLERR | EPOLLHUP))
+    {
+        return 1;
+    }
+
+    if(events & EPOLLOUT)
+    {
+        ret = flushClient(client);
 
-    fds[0].fd = client;
-    fds[0].events = POLLIN;
+        if((ret == 0) && client->closing)
+        {
+            return 1;
+        }
 
-    digest = malloc(params->hashInfos.digestSize);
-    digestTmp = malloc(params->hashInfos.digestSize);
+        return (ret < 0) || ((ret == 0) && waitClient(loop, client, EPOLLIN));
+    }
 
-    while(1)
+    readCount = recv(client->fd, client->in + client->inLength, CLIENT_BUFFER_SIZE - client->inLength, 0);
+
+    if(readCount < 0)
+    {
+        return (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR);
+    }
+
+    if(readCount == 0)
     {
-        pollret = poll(fds, 1, -1);
+        return 1;
+    }
+
+    client->inLength += readCount;
+
+    if(parseRequests(loop, client))
+    {
+        return 1;
+    }
+
+    // Without any request to answer first, an empty line or frame closes the client right away
+    return client->closing && !client->queued;
+}
 
-        if(pollret == -1)
+// Sends the new answers of the queued clients, waiting for the sockets that are full
+void flushQueuedClients(EventLoop* loop)
+{
+    Client* client;
+    uint32_t i;
+    int ret;
+
+    for(i=0 ; i<loop->queuedCount ; i++)
+    {
+        client = loop->queuedClients[i];
+        client->queued = 0;
+        // The answers of a client short of memory are incomplete, they are dropped
+        ret = client->failed ? -1 : flushClient(client);
+
+        if((ret < 0) || ((ret == 0) && client->closing) || ((ret > 0) && waitClient(loop, client, EPOLLOUT)))
         {
-            goto clienterror;
+            closeClient(loop, client);
         }
-        else if(pollret > 0)
+    }
+
+    loop->queuedCount = 0;
+}
+
+void acceptClients(EventLoop* loop)
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    struct epoll_event event;
+    Client* client;
+    int fd, keepaliveFlag = 1, noDelayFlag = 1;
+
+    while((fd = accept(loop->server, (struct sockaddr*) &addr, &addrlen)) != -1)
+    {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+        if(__sync_add_and_fetch(&loop->params->clientsCount, 1) > loop->params->maxClients)
         {
-            readCount = recv(client, line, MAX_LINE_SIZE, 0);
+            __sync_fetch_and_sub(&loop->params->clientsCount, 1);
+            close(fd);
+            continue;
+        }
 
-            if(readCount > 0)
-            {
-                if(line[0] == '\n')
-                {
-                    break;
-                }
+        if(setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &keepaliveFlag, sizeof(keepaliveFlag)) == -1)
+        {
+            perror("Unable to set socket heartbeat for the new client");
+        }
 
-                unhex(line, digest, params->hashInfos.digestSize);
-                lookup(params->index, params->wordlist, params->indexesCount, params->indexEntrySize,
-                       params->indexDataSize, &params->hashInfos, digestTmp, digest, lookupResult, &lookupResultLen);
+        // The answers are already gathered in few sends, Nagle would only hold them back for the client acks
+        if(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelayFlag, sizeof(noDelayFlag)) == -1)
+        {
+            perror("Unable to disable the Nagle algorithm for the new client");
+        }
 
-                if(lookupResultLen == 0)
-                {
-                    send(client, "\n", sizeof(char), 0);
-                }
-                else
-                {
-                    lookupResult[lookupResultLen] = '\n';
-                    send(client, lookupResult, lookupResultLen + 1, 0);
-                }
-            }
-            else if(readCount == 0)
+        client = malloc(sizeof(Client));
+
+        if(client != NULL)
+        {
+            client->out = malloc(MAX_LINE_SIZE + 1);
+        }
+
+        if((client == NULL) || (client->out == NULL))
+        {
+            __sync_fetch_and_sub(&loop->params->clientsCount, 1);
+            close(fd);
+            free(client);
+            continue;
+        }
+
+        client->fd = fd;
+        client->protocol = PROTOCOL_UNKNOWN;
+        client->closing = 0;
+        client->failed = 0;
+        client->queued = 0;
+        client->table = 0;
+        client->frameLeft = 0;
+        client->inLength = 0;
+        client->outSize = MAX_LINE_SIZE + 1;
+        client->outLength = 0;
+        client->outSent = 0;
+
+        event.events = EPOLLIN;
+        event.data.ptr = client;
+
+        if(epoll_ctl(loop->epoll, EPOLL_CTL_ADD, fd, &event) == -1)
+        {
+            __sync_fetch_and_sub(&loop->params->clientsCount, 1);
+            close(fd);
+            free(client->out);
+            free(client);
+            continue;
+        }
+
+        printf("New connection from %s:%u\n", inet_ntoa(addr.sin_addr), addr.sin_port);
+    }
+
+    if((errno != EAGAIN) && (errno != EWOULDBLOCK))
+    {
+        perror("An error occurred while accepting a new connection");
+    }
+}
+
+// Publishes the indexes the loop is about to use. They are checked to still be the current ones once published, so a
+// reload swapping them meanwhile is either seen here or waits for this loop to leave them.
+void acquireIndexes(EventLoop* loop)
+{
+    IndexSet* indexes;
+
+    do
+    {
+        indexes = loop->params->indexes;
+        loop->indexes = indexes;
+        __sync_synchronize();
+    } while(indexes != loop->params->indexes);
+}
+
+void releaseIndexes(EventLoop* loop)
+{
+    __sync_synchronize();
+    loop->indexes = NULL;
+}
+
+// One event loop per thread, each with its own listening socket on the shared port: the kernel spreads the new
+// connections between them. The requests read from all the ready clients are looked up by batches. The indexes are
+// only held while the events are handled, the batches are answered before waiting again.
+void* eventLoop(void* arg)
+{
+    EventLoop* loop = arg;
+    struct epoll_event events[MAX_EVENTS];
+    uint32_t table, tablesCount;
+    int i, eventsCount, allocated = 1;
+
+    loop->results = malloc(REQUESTS_BATCH_SIZE * (MAX_LINE_SIZE + 1));
+    loop->digestTmp = malloc(MAX_DIGEST_SIZE);
+    loop->requestsCount = 0;
+    loop->queuedCount = 0;
+
+    // A reload keeps the hash functions of the indexes, so their digest sizes
+    acquireIndexes(loop);
+    tablesCount = loop->indexes->tablesCount;
+
+    for(table=0 ; table<tablesCount ; table++)
+    {
+        loop->batches[table].count = 0;
+        loop->batches[table].digests = malloc(REQUESTS_BATCH_SIZE * loop->indexes->tables[table].hashInfos.digestSize);
+        allocated &= (loop->batches[table].digests != NULL);
+    }
+
+    releaseIndexes(loop);
+
+    while(allocated && (loop->results != NULL) && (loop->digestTmp != NULL))
+    {
+        eventsCount = epoll_wait(loop->epoll, events, MAX_EVENTS, -1);
+        acquireIndexes(loop);
+
+        if((eventsCount == -1) && (errno != EINTR))
+        {
+            perror("An error occurred while waiting for events");
+            break;
+        }
+
+        for(i=0 ; i<eventsCount ; i++)
+        {
+            if(events[i].data.ptr == NULL)
             {
-                break;
+                acceptClients(loop);
             }
-            else
+            else if(handleClient(loop, events[i].data.ptr, events[i].events))
             {
-                goto clienterror;
+                // A client with requests in the batch is closed once their answers are sent, like after an empty line
+                ((Client*) events[i].data.ptr)->closing = 1;
+
+                if(!((Client*) events[i].data.ptr)->queued)
+                {
+                    closeClient(loop, events[i].data.ptr);
+                }
             }
         }
-    }
 
-    close(client);
+        resolveRequests(loop);
+        flushQueuedClients(loop);
+        releaseIndexes(loop);
+    }
 
-    free(digest);
-    free(digestTmp);
+    releaseIndexes(loop);
 
-    exit(EXIT_SUCCESS);
+    for(table=0 ; table<tablesCount ; table++)
+    {
+        free(loop->batches[table].digests);
+    }
 
-    clienterror:
-    close(client);
+    free(loop->results);
+    free(loop->digestTmp);
 
-    free(digest);
-    free(digestTmp);
+    __sync_fetch_and_sub(&loop->params->runningLoops, 1);
 
-    exit(EXIT_FAILURE);
+    return NULL;
 }
 
-int serveForever(uint16_t port, uint16_t maxClients, SharedParameters* params)
+int openEventLoop(EventLoop* loop, SharedParameters* params)
 {
-    int server, client;
     struct sockaddr_in addr;
-    socklen_t addrlen = sizeof(addr);
-    uint32_t pid;
-    int keepaliveFlag = 1;
+    struct epoll_event event;
+    int reuseFlag = 1;
+
+    loop->params = params;
+    loop->server = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    loop->epoll = -1;
+
+    if(loop->server == -1)
+    {
+        printf("Unable to create the socket.\n");
+        return 1;
+    }
 
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(port);
+    addr.sin_port = htons(params->port);
 
-    signal(SIGCHLD, &childTerminated);
+    if((setsockopt(loop->server, SOL_SOCKET, SO_REUSEADDR, &reuseFlag, sizeof(reuseFlag)) == -1)
+       || (setsockopt(loop->server, SOL_SOCKET, SO_REUSEPORT, &reuseFlag, sizeof(reuseFlag)) == -1)
+       || (bind(loop->server, (struct sockaddr*) &addr, sizeof(addr)) == -1)
+       || (listen(loop->server, SOMAXCONN) == -1))
+    {
+        printf("Unable to listen on port %u.\n", params->port);
+
+        close(loop->server);
+        return 1;
+    }
 
-    server = socket(AF_INET, SOCK_STREAM, 0);
+    loop->epoll = epoll_create1(0);
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
 
-    if(server == 0)
+    if((loop->epoll == -1) || (epoll_ctl(loop->epoll, EPOLL_CTL_ADD, loop->server, &event) == -1))
     {
-        printf("Unable to create the socket.\n");
-        return EXIT_FAILURE;
+        printf("Unable to create the event loop.\n");
+
+        close(loop->server);
+        return 1;
     }
 
-    if(bind(server, (struct sockaddr*) &addr, sizeof(addr)) == -1)
+    return 0;
+}
+
+void closeIndexes(IndexSet* indexes)
+{
+    uint32_t i;
+
+    for(i=0 ; i<indexes->tablesCount ; i++)
     {
-        printf("Unable to listen on port %u.\n", port);
-        return EXIT_FAILURE;
+        closeSegmentedIndex(&indexes->tables[i]);
     }
 
-    printf("The server is listening on port %u for new connections.\n", port);
+    free(indexes);
+}
+
+// Opens every index or manifest of segments, each one for a different hash function. Returns NULL on error.
+IndexSet* openTables(const char** paths, uint32_t pathsCount)
+{
+    IndexSet* indexes = malloc(sizeof(IndexSet));
+    SegmentedIndex* table;
+    const char* segmentPath;
+    int error;
 
-    while(1)
+    if(indexes == NULL)
     {
-        if(childrenRunning >= maxClients)
+        printf("Unable to allocate the indexes.\n");
+        return NULL;
+    }
+
+    for(indexes->tablesCount=0 ; indexes->tablesCount<pathsCount ; indexes->tablesCount++)
+    {
+        table = &indexes->tables[indexes->tablesCount];
+        error = openSegmentedIndex(paths[indexes->tablesCount], table);
+        segmentPath = (table->segmentsCount < table->manifest.count) ? table->manifest.paths[table->segmentsCount] : NULL;
+
+        if(error == 1)
         {
-            wait(NULL);
+            printf("Unable to open the index file: %s\n", segmentPath);
         }
-
-        if(listen(server, 1) == -1)
+        else if(error == 2)
         {
-            perror("An error occurred while listening for a new connection");
-            return EXIT_FAILURE;
+            printf("Invalid index file: %s\n", segmentPath);
         }
-
-        if((client = accept(server, (struct sockaddr*) &addr, &addrlen)) == -1)
+        else if(error == 3)
+        {
+            printf("Unable to find the hash function named: %s\n",
+                   table->segments[table->segmentsCount].header.hashName);
+        }
+        else if(error == 4)
+        {
+            printf("Invalid manifest file: %s\n", paths[indexes->tablesCount]);
+        }
+        else if(error == 5)
         {
-            perror("An error occurred while accepting a new connection");
+            printf("The segment %s does not use the hash function of the first one.\n", segmentPath);
+        }
+        else if(findTable(indexes, table->hashName, strnlen(table->hashName, MAX_HASH_NAME_SIZE))
+                != indexes->tablesCount)
+        {
+            printf("Two indexes use the hash function %.*s.\n", MAX_HASH_NAME_SIZE, table->hashName);
+            error = 1;
         }
 
-        if(setsockopt(client, SOL_SOCKET, SO_KEEPALIVE, &keepaliveFlag, sizeof(keepaliveFlag)) == -1)
+        if(error)
         {
-            perror("Unable to set socket heartbeat for the new client");
+            closeSegmentedIndex(table);
+            closeIndexes(indexes);
+            return NULL;
         }
+    }
 
-        printf("New connection from %s:%u\n", inet_ntoa(addr.sin_addr), addr.sin_port);
+    return indexes;
+}
+
+// Opens and loads the indexes from their paths. The allocation is only confirmed at startup, not on a reload.
+IndexSet* openIndexes(SharedParameters* params, int confirm)
+{
+    IndexSet* indexes = openTables(params->paths, params->pathsCount);
+    uint64_t bufSize = 0;
+    uint8_t answer;
+    uint32_t t, i, filtered;
+
+    if(indexes == NULL)
+    {
+        return NULL;
+    }
 
-        pid = fork();
+    for(t=0 ; t<indexes->tablesCount ; t++)
+    {
+        bufSize += getSegmentedIndexAllocation(&indexes->tables[t], params->tableFlags);
+    }
+
+    // Nothing to confirm when the index is only mapped from the page cache, without a search tree
+    if(confirm && (bufSize != 0) && isatty(STDIN_FILENO))
+    {
+        printf("WARNING: This program will allocate %lu MiB of RAM. Do you want to continue? (y/N)\n", bufSize / MIB);
+        answer = getchar();
 
-        if(pid == -1)
+        if((answer != 'y') && (answer != 'Y'))
         {
-            printf("An error occurred during fork.\n");
-            close(client);
+            printf("ABORTING\n");
+
+            closeIndexes(indexes);
+            return NULL;
         }
-        else if(pid == 0)
+    }
+
+    for(t=0 ; t<indexes->tablesCount ; t++)
+    {
+        if(loadSegmentedIndex(&indexes->tables[t], params->tableFlags))
         {
-            close(server);
-            handleClient(client, params);
+            printf("Unable to load the index: %s\n", params->paths[t]);
+
+            closeIndexes(indexes);
+            return NULL;
         }
-        else
+
+        for(i=0, filtered=0 ; i<indexes->tables[t].segmentsCount ; i++)
         {
-            childrenRunning++;
-            close(client);
+            filtered += (indexes->tables[t].segments[i].filter.blocks != NULL);
         }
+
+        printf("The %.*s index is loaded successfully (%u segments, %u with a filter).\n", MAX_HASH_NAME_SIZE,
+               indexes->tables[t].hashName, indexes->tables[t].segmentsCount, filtered);
     }
 
-    close(server);
-    return EXIT_SUCCESS;
+    return indexes;
 }
 
-int main(int argc, char** argv)
+// Loads the indexes again while the current ones are served, then swaps them in. The old ones are closed once every
+// event loop has left them: the loops waiting for events hold none, the others only until their batches are answered.
+void reloadIndexes(SharedParameters* params, EventLoop* loops, uint32_t loopsCount)
 {
-    uint8_t answer, maxClients;
-    uint16_t port;
-    uint64_t bufSize;
-    FILE* indexFile;
-    IndexHeader indexHeader;
-    SharedParameters params;
+    IndexSet* indexes, *old = params->indexes;
+    uint32_t i;
 
-    setvbuf(stdin, NULL, _IONBF, 0);
-    setvbuf(stdout, NULL, _IONBF, 0);
+    printf("Reloading the indexes.\n");
+    indexes = openIndexes(params, 0);
 
-    if(argc != 4)
+    if(indexes == NULL)
     {
-        printf("Usage: %s <index_file> <port> <max_clients>\n", argv[0]);
-        return EXIT_FAILURE;
+        printf("The reload failed, the current indexes are still served.\n");
+        return;
     }
 
-    port = strtol(argv[2], NULL, 10);
-    maxClients = strtol(argv[3], NULL, 10);
-
-    if(port == 0)
+    // The batches of the event loops are sized by the digest sizes of the hash functions
+    for(i=0 ; i<indexes->tablesCount ; i++)
     {
-        printf("Bad port number: 0.\n");
-        return EXIT_FAILURE;
+        if(strncmp(indexes->tables[i].hashName, old->tables[i].hashName, MAX_HASH_NAME_SIZE) != 0)
+        {
+            printf("The index %s does not use the hash function %.*s anymore, the current indexes are still served.\n",
+                   params->paths[i], MAX_HASH_NAME_SIZE, old->tables[i].hashName);
+
+            closeIndexes(indexes);
+            return;
+        }
     }
 
-    if(maxClients == 0)
+    params->indexes = indexes;
+    __sync_synchronize();
+
+    for(i=0 ; i<loopsCount ; i++)
     {
-        printf("Max clients set to zero. Changing it to 1.\n");
-        maxClients = 1;
+        while(loops[i].indexes == old)
+        {
+            usleep(RELOAD_POLL_INTERVAL);
+        }
     }
 
-    indexFile = fopen(argv[1], "r");
+    closeIndexes(old);
+    printf("The indexes are reloaded.\n");
+}
+
+int serveForever(SharedParameters* params, uint32_t threadsCount)
+{
+    EventLoop* loops = malloc(threadsCount * sizeof(EventLoop));
+    pthread_t* threads = malloc(threadsCount * sizeof(pthread_t));
+    struct timespec timeout = {LOOPS_CHECK_INTERVAL, 0};
+    uint32_t i, started = 0;
+    sigset_t signals;
 
-    if(indexFile == NULL)
+    if((loops == NULL) || (threads == NULL))
     {
-        printf("Unable to open the index file.\n");
+        printf("Unable to allocate the event loops.\n");
+
+        free(loops);
+        free(threads);
         return EXIT_FAILURE;
     }
 
-    if(readIndexHeader(indexFile, &indexHeader))
+    // SIGHUP is blocked since the start, it is only waited for by this thread
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+
+    for(i=0 ; i<threadsCount ; i++)
     {
-        printf("Invalid index file.\n");
+        loops[i].indexes = NULL;
 
-        fclose(indexFile);
-        return EXIT_FAILURE;
+        if(openEventLoop(&loops[i], params))
+        {
+            break;
+        }
     }
 
-    params.indexEntrySize = getIndexEntrySize(&indexHeader);
-    params.indexDataSize = indexHeader.dataBytes;
-    params.indexesCount = getIndexesCount(&indexHeader);
+    if(i == threadsCount)
+    {
+        printf("The server is listening on port %u for new connections.\n", params->port);
 
-    getHashInfos(indexHeader.hashName, &params.hashInfos);
+        for(started=0 ; started<threadsCount ; started++)
+        {
+            __sync_fetch_and_add(&params->runningLoops, 1);
+
+            if(pthread_create(&threads[started], NULL, eventLoop, &loops[started]) != 0)
+            {
+                __sync_fetch_and_sub(&params->runningLoops, 1);
+                break;
+            }
+        }
+    }
 
-    if(params.hashInfos.f == NULL)
+    while(__sync_fetch_and_add(&params->runningLoops, 0) > 0)
     {
-        printf("Unable to find the hash function named: %s\n", indexHeader.hashName);
+        if(sigtimedwait(&signals, NULL, &timeout) == SIGHUP)
+        {
+            reloadIndexes(params, loops, started);
+        }
+    }
 
-        fclose(indexFile);
-        return EXIT_FAILURE;
+    for(i=0 ; i<started ; i++)
+    {
+        pthread_join(threads[i], NULL);
     }
 
-    fseek(indexFile, 0, SEEK_END);
-    bufSize = ftell(indexFile) - sizeof(IndexHeader);
-    fseek(indexFile, sizeof(IndexHeader), SEEK_SET);
+    free(loops);
+    free(threads);
 
-    printf("WARNING: This program will allocate %lu MiB of RAM. Do you want to continue? (y/N)\n", bufSize / MIB);
-    answer = getchar();
+    return EXIT_FAILURE;
+}
 
-    if((answer != 'y') && (answer != 'Y'))
-    {
-        printf("ABORTING\n");
+int main(int argc, char** argv)
+{
+    uint32_t threadsCount = sysconf(_SC_NPROCESSORS_ONLN);
+    SharedParameters params;
+    sigset_t signals;
+    int i;
 
-        fclose(indexFile);
+    setvbuf(stdin, NULL, _IONBF, 0);
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    if(argc < 4)
+    {
+        printf("Usage: %s <index_file|manifest> <port> <max_clients> [--index <index_file|manifest>]... [--threads <count>] "
+               "%s\n", argv[0], getTableOptionsUsage());
         return EXIT_FAILURE;
     }
 
-    params.index = malloc(bufSize);
+    params.paths[0] = argv[1];
+    params.pathsCount = 1;
+    params.tableFlags = 0;
 
-    if(params.index == NULL)
+    for(i=4 ; i<argc ; i++)
     {
-        printf("Unable to allocate the index.\n");
+        if((strcmp(argv[i], "--threads") == 0) && (i + 1 < argc))
+        {
+            threadsCount = strtol(argv[++i], NULL, 10);
+        }
+        else if((strcmp(argv[i], "--index") == 0) && (i + 1 < argc))
+        {
+            if(params.pathsCount == MAX_TABLES)
+            {
+                printf("Too many indexes, at most %u can be served.\n", MAX_TABLES);
+                return EXIT_FAILURE;
+            }
 
-        fclose(indexFile);
+            params.paths[params.pathsCount++] = argv[++i];
+        }
+        else if(parseTableOption(argv[i], &params.tableFlags))
+        {
+            printf("Unknown option: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    params.port = strtol(argv[2], NULL, 10);
+    params.maxClients = strtol(argv[3], NULL, 10);
+    params.clientsCount = 0;
+    params.runningLoops = 0;
+
+    if(params.port == 0)
+    {
+        printf("Bad port number: 0.\n");
         return EXIT_FAILURE;
     }
 
-    params.wordlist = params.index + indexHeader.wordlistOffset;
-    fread(params.index, sizeof(uint8_t), bufSize, indexFile);
+    if(params.maxClients == 0)
+    {
+        printf("Max clients set to zero. Changing it to 1.\n");
+        params.maxClients = 1;
+    }
 
-    fclose(indexFile);
+    if(threadsCount == 0)
+    {
+        threadsCount = 1;
+    }
 
-    printf("The index is loaded successfully.\n");
+    // Blocked before any thread is created, warmers included, so a SIGHUP during the first load waits for the event
+    // loops instead of killing the server
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    params.indexes = openIndexes(&params, 1);
+
+    if(params.indexes == NULL)
+    {
+        return EXIT_FAILURE;
+    }
 
-    serveForever(port, maxClients, &params);
+    serveForever(&params, threadsCount);
 
-    free(params.index);
+    closeIndexes(params.indexes);
 
     return EXIT_SUCCESS;
 }
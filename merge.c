@@ -2,15 +2,45 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 #include "index.h"
+#include "merging.h"
+#include "dedup.h"
 #include "defines.h"
 
+// More ranges than threads evens out the ranges holding more entries
+#define MERGE_PARTS_PER_THREAD 4
+
+// The merged index always has a directory
+#define OUTPUT_ENTRIES_OFFSET (sizeof(IndexHeader) + INDEX_DIRECTORY_SIZE)
+
 typedef struct {
     FILE* f;
     IndexHeader header;
+    uint8_t* mapped;
+    uint64_t size;
 } IndexFile;
 
+// Shared state of a merge split in disjoint hash ranges. The output is mapped and every range is written at its final
+// offset, so the threads take the ranges and the wordlist copies in any order.
+typedef struct {
+    IndexFile* indexFiles;
+    int indexesCount;
+    uint8_t dataBytes;
+    uint8_t indexEntrySize;
+    uint64_t* wordlistBases;
+    uint64_t* splits;
+    uint32_t partsCount;
+    uint8_t* output;
+    uint64_t wordlistStart;
+    size_t streamBufferSize;
+    uint32_t nextTask;
+    int error;
+} ParallelMerge;
+
 void showProgress(uint64_t written, uint64_t total)
 {
     float percents = (float) written / (float) total * 100;
@@ -33,131 +63,551 @@ int openIndexFile(const char* filePath, IndexFile* out)
         return 1;
     }
 
+    out->mapped = NULL;
+    out->size = getFileSize(out->f);
+
+    return 0;
+}
+
+uint64_t getWordlistSize(IndexFile* index)
+{
+    return index->size - index->header.wordlistOffset - getIndexEntriesOffset(&index->header);
+}
+
+// The deduplication reads the pointed words in place
+int mapIndexFile(IndexFile* index)
+{
+    index->mapped = mmap(NULL, index->size, PROT_READ, MAP_SHARED, fileno(index->f), 0);
+
+    if(index->mapped == MAP_FAILED)
+    {
+        index->mapped = NULL;
+        return 1;
+    }
+
     return 0;
 }
 
+uint8_t* getMappedWordlist(IndexFile* index)
+{
+    return index->mapped + getIndexEntriesOffset(&index->header) + index->header.wordlistOffset;
+}
+
 int copyWordlist(IndexFile* index, FILE* outputFile)
 {
-    uint8_t* copyBuffer = malloc(MIB);
-    uint32_t readSize;
-    int64_t currentIndexPos = ftell(index->f);
+    return copyFileTail(index->f, index->header.wordlistOffset + getIndexEntriesOffset(&index->header), outputFile);
+}
+
+void closeIndexFiles(IndexFile* indexFiles, int count)
+{
+    int i;
+
+    for(i=0 ; i<count ; i++)
+    {
+        if(indexFiles[i].mapped != NULL)
+        {
+            munmap(indexFiles[i].mapped, indexFiles[i].size);
+        }
+
+        fclose(indexFiles[i].f);
+    }
+
+    free(indexFiles);
+}
+
+// Position of the first entry of the index whose hash is not below key
+uint64_t findSplit(IndexFile* index, uint8_t indexEntrySize, const uint8_t* key)
+{
+    uint8_t entry[INDEX_HASH_SIZE];
+    uint64_t l = 0, u = getIndexesCount(&index->header), m;
+
+    while(l < u)
+    {
+        m = l + (u - l) / 2;
+
+        if(pread(fileno(index->f), entry, INDEX_HASH_SIZE, getIndexEntriesOffset(&index->header) + m * indexEntrySize)
+           != INDEX_HASH_SIZE)
+        {
+            return u;
+        }
+
+        if(memcmp(entry, key, INDEX_HASH_SIZE) < 0)
+        {
+            l = m + 1;
+        }
+        else
+        {
+            u = m;
+        }
+    }
+
+    return l;
+}
+
+// Entries of the part in all the indexes, and where they start in the output
+uint64_t getPartEntries(ParallelMerge* merge, uint32_t part, uint64_t* start)
+{
+    uint64_t* splits = merge->splits + part * merge->indexesCount;
+    uint64_t count = 0;
+    int i;
+
+    *start = 0;
 
-    if(copyBuffer == NULL)
+    for(i=0 ; i<merge->indexesCount ; i++)
+    {
+        *start += splits[i];
+        count += splits[merge->indexesCount + i] - splits[i];
+    }
+
+    return count;
+}
+
+int mergePart(ParallelMerge* merge, uint32_t part, EntryStream* streams, uint8_t* readBuffers)
+{
+    uint64_t* splits = merge->splits + part * merge->indexesCount;
+    uint64_t start, count = getPartEntries(merge, part, &start);
+    EntryMerger merger;
+    EntryWriter entries;
+    uint8_t* entry, dataBytes = merge->dataBytes;
+    uint32_t source;
+    int i;
+
+    for(i=0 ; i<merge->indexesCount ; i++)
+    {
+        openEntryStream(&streams[i], fileno(merge->indexFiles[i].f),
+                        getIndexEntriesOffset(&merge->indexFiles[i].header) + splits[i] * merge->indexEntrySize,
+                        splits[merge->indexesCount + i] - splits[i], merge->indexEntrySize,
+                        readBuffers + i * merge->streamBufferSize, merge->streamBufferSize);
+    }
+
+    if(initEntryMerger(&merger, streams, merge->indexesCount))
     {
         return 1;
     }
 
-    fseek(index->f, index->header.wordlistOffset + sizeof(IndexHeader), SEEK_SET);
+    initEntryWriter(&entries, merge->output + OUTPUT_ENTRIES_OFFSET + start * merge->indexEntrySize,
+                    count * merge->indexEntrySize, NULL);
 
-    while((readSize = fread(copyBuffer, 1, MIB, index->f)) != 0)
+    while((entries.used < entries.size) && ((entry = nextMergedEntry(&merger, &source)) != NULL))
     {
-        fwrite(copyBuffer, readSize, 1, outputFile);
+        if(!(entry[merge->indexEntrySize - 1] & INLINE_WORD_MASK) && (merge->wordlistBases[source] != 0))
+        {
+            writeIndexEntryPointer(entry,
+                                   getPointerFromData(entry + INDEX_HASH_SIZE, dataBytes) + merge->wordlistBases[source],
+                                   dataBytes,
+                                   (entry[merge->indexEntrySize - 1] & WORD_TYPE_MASK) >> INLINE_WORD_BITS,
+                                   &entries);
+        }
+        else
+        {
+            writeIndexEntry(entry, merge->indexEntrySize, &entries);
+        }
     }
 
-    fseek(index->f, currentIndexPos, SEEK_SET);
+    freeEntryMerger(&merger);
+
+    // A short read ends its stream early
+    return entries.used != entries.size;
+}
+
+int copyWordlistPart(ParallelMerge* merge, int index)
+{
+    IndexFile* indexFile = &merge->indexFiles[index];
+    uint8_t* out = merge->output + merge->wordlistStart + merge->wordlistBases[index];
+    uint64_t offset = getIndexEntriesOffset(&indexFile->header) + indexFile->header.wordlistOffset;
+    uint64_t size = getWordlistSize(indexFile), done = 0;
+    ssize_t readSize;
+
+    while(done < size)
+    {
+        readSize = pread(fileno(indexFile->f), out + done, size - done, offset + done);
+
+        if(readSize <= 0)
+        {
+            return 1;
+        }
+
+        done += readSize;
+    }
 
-    free(copyBuffer);
     return 0;
 }
 
-int main(int argc, char** argv)
+// The first tasks are the hash ranges, the next ones the wordlist copies
+void* mergeWorker(void* arg)
 {
-    IndexFile indexFile1, indexFile2;
+    ParallelMerge* merge = arg;
+    EntryStream* streams = malloc(merge->indexesCount * sizeof(EntryStream));
+    uint8_t* readBuffers = malloc(merge->indexesCount * merge->streamBufferSize);
+    uint32_t task;
+    int error = (streams == NULL) || (readBuffers == NULL);
+
+    while(!error && ((task = __sync_fetch_and_add(&merge->nextTask, 1)) < merge->partsCount + merge->indexesCount))
+    {
+        if(task < merge->partsCount)
+        {
+            error = mergePart(merge, task, streams, readBuffers);
+        }
+        else
+        {
+            error = copyWordlistPart(merge, task - merge->partsCount);
+        }
+    }
+
+    if(error)
+    {
+        merge->error = 1;
+    }
+
+    free(streams);
+    free(readBuffers);
+
+    return NULL;
+}
+
+// Merges the indexes in partsCount ranges of the hash space. The range bounds are found by binary search in every
+// index, which gives each range its place in the output file, mapped at its final size.
+int mergeParallel(IndexFile* indexFiles, int indexesCount, uint64_t* wordlistBases, uint64_t totalIndexCount,
+                  uint64_t totalWordlistSize, uint32_t threadsCount, const char* outputPath)
+{
+    ParallelMerge merge;
+    uint8_t key[INDEX_HASH_SIZE];
+    uint64_t outputSize, bound;
+    pthread_t* threads;
     FILE* outputFile;
-    uint8_t indexEntrySize;
-    uint64_t i, j, k, index1Count, index2Count, totalIndexCount, firstIndexWordlistSize, wordlistOffset;
-    uint8_t* tmp1, *tmp2;
+    uint32_t part, started;
+    int i, j;
+
+    merge.indexFiles = indexFiles;
+    merge.indexesCount = indexesCount;
+    merge.dataBytes = indexFiles[0].header.dataBytes;
+    merge.indexEntrySize = getIndexEntrySize(&indexFiles[0].header);
+    merge.wordlistBases = wordlistBases;
+    merge.partsCount = threadsCount * MERGE_PARTS_PER_THREAD;
+    merge.wordlistStart = OUTPUT_ENTRIES_OFFSET + totalIndexCount * merge.indexEntrySize;
+    merge.streamBufferSize = READ_BUFFER_SIZE / threadsCount;
+    merge.nextTask = 0;
+    merge.error = 0;
+
+    merge.splits = malloc((merge.partsCount + 1) * indexesCount * sizeof(uint64_t));
+    threads = malloc(threadsCount * sizeof(pthread_t));
+
+    if((merge.splits == NULL) || (threads == NULL))
+    {
+        free(merge.splits);
+        free(threads);
+        return 1;
+    }
+
+    // The hashes are uniform, so the ranges split the 64 bits hash prefix space evenly
+    for(part=0 ; part<=merge.partsCount ; part++)
+    {
+        bound = (uint64_t) (((unsigned __int128) part << 64) / merge.partsCount);
+
+        for(j=0 ; j<INDEX_HASH_SIZE ; j++)
+        {
+            key[j] = bound >> ((INDEX_HASH_SIZE - 1 - j) << 3);
+        }
+
+        for(i=0 ; i<indexesCount ; i++)
+        {
+            merge.splits[part * indexesCount + i] = (part == merge.partsCount)
+                                                    ? (uint64_t) getIndexesCount(&indexFiles[i].header)
+                                                    : ((part == 0) ? 0 : findSplit(&indexFiles[i], merge.indexEntrySize, key));
+        }
+    }
+
+    outputSize = merge.wordlistStart + totalWordlistSize;
+    outputFile = fopen(outputPath, "w+");
+
+    if(outputFile == NULL)
+    {
+        free(merge.splits);
+        free(threads);
+        return 1;
+    }
+
+    writeIndexHeader(outputFile, INDEX_MAGIC_DIRECTORY, indexFiles[0].header.hashName, merge.dataBytes,
+                     totalIndexCount * merge.indexEntrySize);
+    fflush(outputFile);
+
+    merge.output = MAP_FAILED;
+
+    if(ftruncate(fileno(outputFile), outputSize) == 0)
+    {
+        merge.output = mmap(NULL, outputSize, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(outputFile), 0);
+    }
+
+    if(merge.output == MAP_FAILED)
+    {
+        fclose(outputFile);
+        free(merge.splits);
+        free(threads);
+        return 1;
+    }
+
+    for(started=0 ; started<threadsCount ; started++)
+    {
+        if(pthread_create(&threads[started], NULL, mergeWorker, &merge) != 0)
+        {
+            break;
+        }
+    }
+
+    // Without any thread the work is still done here
+    if(started == 0)
+    {
+        mergeWorker(&merge);
+    }
+
+    for(part=0 ; part<started ; part++)
+    {
+        pthread_join(threads[part], NULL);
+    }
+
+    munmap(merge.output, outputSize);
+
+    if(!merge.error)
+    {
+        merge.error = updateIndexDirectory(outputFile);
+    }
+
+    fclose(outputFile);
+    free(merge.splits);
+    free(threads);
+
+    return merge.error;
+}
+
+int main(int argc, char** argv)
+{
+    IndexFile* indexFiles;
+    FILE* outputFile, *wordsFile = NULL;
+    Deduplicator dedup;
+    EntryStream* streams;
+    EntryMerger merger;
+    EntryWriter entries;
+    uint8_t indexEntrySize, dataBytes;
+    uint64_t k, totalIndexCount = 0, totalWordlistSize = 0, wordlistOffset;
+    uint64_t* wordlistBases;
+    uint8_t* entry, *readBuffers, *writeBuffer;
+    uint32_t source;
+    char* wordsPath;
+    uint32_t threadsCount = 1;
+    int i, indexesCount, firstIndex = 1, deduplicate = 0, error = 0;
+
+    for( ; (firstIndex < argc) && (strncmp(argv[firstIndex], "--", 2) == 0) ; firstIndex++)
+    {
+        if(strcmp(argv[firstIndex], "--dedup") == 0)
+        {
+            deduplicate = 1;
+        }
+        else if((strcmp(argv[firstIndex], "--threads") == 0) && (firstIndex + 1 < argc))
+        {
+            threadsCount = strtol(argv[++firstIndex], NULL, 10);
+
+            // 0 uses every online core
+            if(threadsCount == 0)
+            {
+                threadsCount = sysconf(_SC_NPROCESSORS_ONLN);
+            }
+        }
+        else
+        {
+            printf("Unknown option: %s\n", argv[firstIndex]);
+            return EXIT_FAILURE;
+        }
+    }
 
-    if(argc != 4)
+    if(argc - firstIndex < 3)
     {
-        printf("Usage: %s <index_file1> <index_file2> <output_file>\n", argv[0]);
+        printf("Usage: %s [--dedup] [--threads <count>] <index_file1> <index_file2> [<index_file3> ...] <output_file>\n", argv[0]);
         return EXIT_FAILURE;
     }
 
-    if(openIndexFile(argv[1], &indexFile1))
+    indexesCount = argc - firstIndex - 1;
+    indexFiles = malloc(indexesCount * sizeof(IndexFile));
+
+    if(indexFiles == NULL)
     {
-        printf("Unable to open the first index file.\n");
+        printf("Unable to allocate the index files.\n");
         return EXIT_FAILURE;
     }
 
-    if(openIndexFile(argv[2], &indexFile2))
+    for(i=0 ; i<indexesCount ; i++)
     {
-        printf("Unable to open the second index file.\n");
+        if(openIndexFile(argv[firstIndex + i], &indexFiles[i]))
+        {
+            printf("Unable to open the index file %s.\n", argv[firstIndex + i]);
 
-        fclose(indexFile1.f);
-        return EXIT_FAILURE;
+            closeIndexFiles(indexFiles, i);
+            return EXIT_FAILURE;
+        }
+
+        if(indexFiles[i].header.dataBytes != indexFiles[0].header.dataBytes)
+        {
+            printf("Index entry data bytes mismatch.\n");
+
+            closeIndexFiles(indexFiles, i + 1);
+            return EXIT_FAILURE;
+        }
+
+        if(memcmp(indexFiles[i].header.hashName, indexFiles[0].header.hashName, MAX_HASH_NAME_SIZE) != 0)
+        {
+            printf("Index hash names mismatch.\n");
+
+            closeIndexFiles(indexFiles, i + 1);
+            return EXIT_FAILURE;
+        }
+
+        if(deduplicate && mapIndexFile(&indexFiles[i]))
+        {
+            printf("Unable to map the index file %s.\n", argv[firstIndex + i]);
+
+            closeIndexFiles(indexFiles, i + 1);
+            return EXIT_FAILURE;
+        }
     }
 
-    if(indexFile1.header.dataBytes != indexFile2.header.dataBytes)
+    dataBytes = indexFiles[0].header.dataBytes;
+    indexEntrySize = getIndexEntrySize(&indexFiles[0].header);
+
+    streams = malloc(indexesCount * sizeof(EntryStream));
+    wordlistBases = malloc(indexesCount * sizeof(uint64_t));
+    readBuffers = malloc(indexesCount * (size_t) READ_BUFFER_SIZE);
+    writeBuffer = malloc(WRITE_BUFFER_SIZE);
+
+    if((streams == NULL) || (wordlistBases == NULL) || (readBuffers == NULL) || (writeBuffer == NULL))
     {
-        printf("Index entry data bytes mismatch.\n");
+        printf("Unable to allocate the merge buffers.\n");
 
-        fclose(indexFile1.f);
-        fclose(indexFile2.f);
+        free(streams);
+        free(wordlistBases);
+        free(readBuffers);
+        free(writeBuffer);
+        closeIndexFiles(indexFiles, indexesCount);
         return EXIT_FAILURE;
     }
 
-    if(memcmp(indexFile1.header.hashName, indexFile2.header.hashName, MAX_HASH_NAME_SIZE) != 0)
+    // The wordlists are appended one after the other, so the pointers of each index move by the size of the previous ones
+    for(i=0 ; i<indexesCount ; i++)
+    {
+        openEntryStream(&streams[i], fileno(indexFiles[i].f), getIndexEntriesOffset(&indexFiles[i].header),
+                        getIndexesCount(&indexFiles[i].header), indexEntrySize, readBuffers + i * (size_t) READ_BUFFER_SIZE, READ_BUFFER_SIZE);
+
+        wordlistBases[i] = totalWordlistSize;
+        totalIndexCount += getIndexesCount(&indexFiles[i].header);
+        totalWordlistSize += getWordlistSize(&indexFiles[i]);
+    }
+
+    if(!isDataSizeValid(totalWordlistSize, dataBytes << 3))
     {
-        printf("Index hash names mismatch.\n");
+        printf("The merged wordlist is too large for %u data bytes.\n", dataBytes);
 
-        fclose(indexFile1.f);
-        fclose(indexFile2.f);
+        free(streams);
+        free(wordlistBases);
+        free(readBuffers);
+        free(writeBuffer);
+        closeIndexFiles(indexFiles, indexesCount);
         return EXIT_FAILURE;
     }
 
-    outputFile = fopen(argv[3], "w");
+    // The deduplication rewrites the pointers in entries order, so it stays on a single output cursor
+    if((threadsCount > 1) && !deduplicate)
+    {
+        error = mergeParallel(indexFiles, indexesCount, wordlistBases, totalIndexCount, totalWordlistSize, threadsCount,
+                              argv[argc - 1]);
 
-    if(outputFile == NULL)
+        free(streams);
+        free(wordlistBases);
+        free(readBuffers);
+        free(writeBuffer);
+        closeIndexFiles(indexFiles, indexesCount);
+
+        if(error)
+        {
+            printf("Unable to write the output file.\n");
+            return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+    }
+
+    outputFile = fopen(argv[argc - 1], "w+");
+
+    if((outputFile == NULL) || initEntryMerger(&merger, streams, indexesCount))
     {
         printf("Unable to open the output file.\n");
 
-        fclose(indexFile1.f);
-        fclose(indexFile2.f);
+        if(outputFile != NULL)
+        {
+            fclose(outputFile);
+        }
+
+        free(streams);
+        free(wordlistBases);
+        free(readBuffers);
+        free(writeBuffer);
+        closeIndexFiles(indexFiles, indexesCount);
         return EXIT_FAILURE;
     }
 
-    indexEntrySize = getIndexEntrySize(&indexFile1.header);
-    index1Count = getIndexesCount(&indexFile1.header);
-    index2Count = getIndexesCount(&indexFile2.header);
-    totalIndexCount = index1Count + index2Count;
+    initEntryWriter(&entries, writeBuffer, WRITE_BUFFER_SIZE, outputFile);
 
-    firstIndexWordlistSize = getFileSize(indexFile1.f) - indexFile1.header.wordlistOffset - sizeof(IndexHeader);
+    // The kept pointed words are collected in a temporary file, appended once the entries are written
+    if(deduplicate)
+    {
+        wordsPath = malloc(strlen(argv[argc - 1]) + sizeof(WORDS_FILE_SUFFIX));
 
-    tmp1 = malloc(indexEntrySize);
-    tmp2 = malloc(indexEntrySize);
+        if(wordsPath != NULL)
+        {
+            sprintf(wordsPath, "%s%s", argv[argc - 1], WORDS_FILE_SUFFIX);
+            wordsFile = fopen(wordsPath, "w+");
+            unlink(wordsPath);
+            free(wordsPath);
+        }
 
-    // This header is only a placeholder for now.
-    writeIndexHeader(outputFile, indexFile1.header.hashName, indexFile1.header.dataBytes, 0);
+        if((wordsFile == NULL) || initDeduplicator(&dedup, dataBytes, &entries, wordsFile))
+        {
+            printf("Unable to set up the deduplication.\n");
 
-    fread(tmp1, indexEntrySize, 1, indexFile1.f);
-    fread(tmp2, indexEntrySize, 1, indexFile2.f);
+            if(wordsFile != NULL)
+            {
+                fclose(wordsFile);
+            }
 
-    for(i=0, j=0, k=0 ; k<totalIndexCount ; k++)
+            fclose(outputFile);
+            freeEntryMerger(&merger);
+            free(streams);
+            free(wordlistBases);
+            free(readBuffers);
+            free(writeBuffer);
+            closeIndexFiles(indexFiles, indexesCount);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // This header and the directory are only placeholders for now.
+    writeIndexHeader(outputFile, INDEX_MAGIC_DIRECTORY, indexFiles[0].header.hashName, dataBytes, 0);
+    reserveIndexDirectory(outputFile);
+
+    for(k=0 ; (entry = nextMergedEntry(&merger, &source)) != NULL ; k++)
     {
-        if(i < index1Count && (j >= index2Count || (memcmp(tmp1, tmp2, INDEX_HASH_SIZE) < 0)))
+        if(deduplicate)
         {
-            fwrite(tmp1, indexEntrySize, 1, outputFile);
-            fread(tmp1, indexEntrySize, 1, indexFile1.f);
-            i++;
+            addDedupEntry(&dedup, entry, getMappedWordlist(&indexFiles[source]), getWordlistSize(&indexFiles[source]));
+        }
+        else if(!(entry[indexEntrySize - 1] & INLINE_WORD_MASK) && (wordlistBases[source] != 0))
+        {
+            writeIndexEntryPointer(entry,
+                                   getPointerFromData(entry + INDEX_HASH_SIZE, dataBytes) + wordlistBases[source],
+                                   dataBytes,
+                                   (entry[indexEntrySize - 1] & WORD_TYPE_MASK) >> INLINE_WORD_BITS,
+                                   &entries);
         }
         else
         {
-            if(!(tmp2[indexEntrySize - 1] & INLINE_WORD_MASK))
-            {
-                writeIndexEntryPointer(tmp2,
-                                       getPointerFromData(tmp2 + INDEX_HASH_SIZE, indexFile1.header.dataBytes) + firstIndexWordlistSize,
-                                       indexFile1.header.dataBytes,
-                                       (tmp2[indexEntrySize - 1] & WORD_TYPE_MASK) >> INLINE_WORD_BITS,
-                                       outputFile);
-            }
-            else
-            {
-                fwrite(tmp2, indexEntrySize, 1, outputFile);
-            }
-
-            fread(tmp2, indexEntrySize, 1, indexFile2.f);
-            j++;
+            writeIndexEntry(entry, indexEntrySize, &entries);
         }
 
         if((k % PROGRESS_UPDATE_COUNT) == 0)
@@ -166,20 +616,51 @@ int main(int argc, char** argv)
         }
     }
 
-    wordlistOffset = ftell(outputFile) - sizeof(IndexHeader);
+    if(deduplicate)
+    {
+        error = finishDeduplicator(&dedup);
+
+        printf("%lu duplicate entries removed, %lu / %lu wordlist bytes kept.\n", dedup.removedEntries,
+               dedup.wordlistSize, totalWordlistSize);
+    }
 
-    copyWordlist(&indexFile1, outputFile);
-    copyWordlist(&indexFile2, outputFile);
+    error |= flushEntryWriter(&entries);
+
+    wordlistOffset = ftell(outputFile) - OUTPUT_ENTRIES_OFFSET;
+
+    if(deduplicate)
+    {
+        error |= fflush(wordsFile) || copyFileTail(wordsFile, 0, outputFile);
+
+        freeDeduplicator(&dedup);
+        fclose(wordsFile);
+    }
+    else
+    {
+        for(i=0 ; i<indexesCount ; i++)
+        {
+            error |= copyWordlist(&indexFiles[i], outputFile);
+        }
+    }
 
     rewind(outputFile);
-    writeIndexHeader(outputFile, indexFile1.header.hashName, indexFile1.header.dataBytes, wordlistOffset);
+    writeIndexHeader(outputFile, INDEX_MAGIC_DIRECTORY, indexFiles[0].header.hashName, dataBytes, wordlistOffset);
+    error |= updateIndexDirectory(outputFile);
 
-    free(tmp1);
-    free(tmp2);
+    freeEntryMerger(&merger);
+    free(streams);
+    free(wordlistBases);
+    free(readBuffers);
+    free(writeBuffer);
 
-    fclose(indexFile1.f);
-    fclose(indexFile2.f);
+    closeIndexFiles(indexFiles, indexesCount);
     fclose(outputFile);
 
+    if(error)
+    {
+        printf("Unable to write the output file.\n");
+        return EXIT_FAILURE;
+    }
+
     return EXIT_SUCCESS;
 }
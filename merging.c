@@ -0,0 +1,173 @@
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "merging.h"
+
+static int fillEntryStream(EntryStream* stream)
+{
+    size_t toRead = stream->bufferSize / stream->entrySize;
+    ssize_t readSize;
+
+    if(toRead > stream->remaining)
+    {
+        toRead = stream->remaining;
+    }
+
+    toRead *= stream->entrySize;
+    stream->position = 0;
+    stream->length = 0;
+
+    while(stream->length < toRead)
+    {
+        readSize = pread(stream->fd, stream->buffer + stream->length, toRead - stream->length, stream->offset);
+
+        if(readSize <= 0)
+        {
+            stream->remaining = 0;
+            return 1;
+        }
+
+        stream->length += readSize;
+        stream->offset += readSize;
+    }
+
+    stream->remaining -= toRead / stream->entrySize;
+
+    // Let the kernel read the next block ahead while this one is consumed
+    if(stream->remaining > 0)
+    {
+        posix_fadvise(stream->fd, stream->offset, stream->bufferSize, POSIX_FADV_WILLNEED);
+    }
+
+    return 0;
+}
+
+// bufferSize must hold at least one entry.
+void openEntryStream(EntryStream* stream, int fd, uint64_t offset, uint64_t count, uint8_t entrySize, uint8_t* buffer,
+                     size_t bufferSize)
+{
+    stream->fd = fd;
+    stream->entrySize = entrySize;
+    stream->offset = offset;
+    stream->remaining = count;
+    stream->buffer = buffer;
+    stream->bufferSize = bufferSize - bufferSize % entrySize;
+    stream->position = 0;
+    stream->length = 0;
+}
+
+// Returns the current entry of the stream, or NULL once it is exhausted. The entry stays valid until skipEntry.
+uint8_t* peekEntry(EntryStream* stream)
+{
+    if((stream->position == stream->length) && ((stream->remaining == 0) || fillEntryStream(stream)))
+    {
+        return NULL;
+    }
+
+    return stream->buffer + stream->position;
+}
+
+void skipEntry(EntryStream* stream)
+{
+    stream->position += stream->entrySize;
+}
+
+static int isBefore(EntryMerger* merger, uint32_t a, uint32_t b)
+{
+    int cmp = memcmp(peekEntry(&merger->streams[a]), peekEntry(&merger->streams[b]), INDEX_HASH_SIZE);
+
+    return (cmp < 0) || ((cmp == 0) && (a < b));
+}
+
+static void siftDown(EntryMerger* merger, uint32_t i)
+{
+    uint32_t child, tmp;
+
+    while((child = 2 * i + 1) < merger->heapSize)
+    {
+        if((child + 1 < merger->heapSize) && isBefore(merger, merger->heap[child + 1], merger->heap[child]))
+        {
+            child++;
+        }
+
+        if(!isBefore(merger, merger->heap[child], merger->heap[i]))
+        {
+            break;
+        }
+
+        tmp = merger->heap[i];
+        merger->heap[i] = merger->heap[child];
+        merger->heap[child] = tmp;
+        i = child;
+    }
+}
+
+int initEntryMerger(EntryMerger* merger, EntryStream* streams, uint32_t streamsCount)
+{
+    uint32_t i;
+
+    merger->streams = streams;
+    merger->heap = malloc(streamsCount * sizeof(uint32_t));
+    merger->heapSize = 0;
+    merger->pending = 0;
+
+    if(merger->heap == NULL)
+    {
+        return 1;
+    }
+
+    for(i=0 ; i<streamsCount ; i++)
+    {
+        if(peekEntry(&streams[i]) != NULL)
+        {
+            merger->heap[merger->heapSize++] = i;
+        }
+    }
+
+    for(i=merger->heapSize/2 ; i>0 ; i--)
+    {
+        siftDown(merger, i - 1);
+    }
+
+    return 0;
+}
+
+// Returns the smallest entry left in the streams and the stream it comes from, or NULL once they are all exhausted.
+// The entry stays valid until the next call.
+uint8_t* nextMergedEntry(EntryMerger* merger, uint32_t* source)
+{
+    EntryStream* top;
+
+    if(merger->pending)
+    {
+        top = &merger->streams[merger->heap[0]];
+        skipEntry(top);
+
+        if(peekEntry(top) == NULL)
+        {
+            merger->heap[0] = merger->heap[--merger->heapSize];
+        }
+
+        siftDown(merger, 0);
+    }
+
+    if(merger->heapSize == 0)
+    {
+        merger->pending = 0;
+        return NULL;
+    }
+
+    merger->pending = 1;
+
+    if(source != NULL)
+    {
+        *source = merger->heap[0];
+    }
+
+    return peekEntry(&merger->streams[merger->heap[0]]);
+}
+
+void freeEntryMerger(EntryMerger* merger)
+{
+    free(merger->heap);
+}
@@ -0,0 +1,39 @@
+#ifndef MERGING_H
+#define MERGING_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "index.h"
+
+// Reads count entries starting at offset in fd through a caller-owned buffer.
+typedef struct {
+    int fd;
+    uint8_t entrySize;
+    uint64_t offset;
+    uint64_t remaining;
+    uint8_t* buffer;
+    size_t bufferSize;
+    size_t position;
+    size_t length;
+} EntryStream;
+
+// Merges sorted entry streams with a binary heap ordered on the entries hash, then on the streams order.
+typedef struct {
+    EntryStream* streams;
+    uint32_t* heap;
+    uint32_t heapSize;
+    int pending;
+} EntryMerger;
+
+void openEntryStream(EntryStream* stream, int fd, uint64_t offset, uint64_t count, uint8_t entrySize, uint8_t* buffer,
+                     size_t bufferSize);
+uint8_t* peekEntry(EntryStream* stream);
+void skipEntry(EntryStream* stream);
+
+int initEntryMerger(EntryMerger* merger, EntryStream* streams, uint32_t streamsCount);
+uint8_t* nextMergedEntry(EntryMerger* merger, uint32_t* source);
+void freeEntryMerger(EntryMerger* merger);
+
+#endif //MERGING_H
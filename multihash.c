@@ -0,0 +1,182 @@
+#include <openssl/md5.h>
+#include <openssl/sha.h>
+
+#include "multihash.h"
+
+typedef unsigned char* (*HashFunction)(const unsigned char*, size_t, unsigned char*);
+typedef void (*LanesFunction)(const unsigned char* const*, const size_t*, unsigned char* const*);
+
+static const uint32_t md5Constants[64] = {
+        0xD76AA478, 0xE8C7B756, 0x242070DB, 0xC1BDCEEE, 0xF57C0FAF, 0x4787C62A, 0xA8304613, 0xFD469501,
+        0x698098D8, 0x8B44F7AF, 0xFFFF5BB1, 0x895CD7BE, 0x6B901122, 0xFD987193, 0xA679438E, 0x49B40821,
+        0xF61E2562, 0xC040B340, 0x265E5A51, 0xE9B6C7AA, 0xD62F105D, 0x02441453, 0xD8A1E681, 0xE7D3FBC8,
+        0x21E1CDE6, 0xC33707D6, 0xF4D50D87, 0x455A14ED, 0xA9E3E905, 0xFCEFA3F8, 0x676F02D9, 0x8D2A4C8A,
+        0xFFFA3942, 0x8771F681, 0x6D9D6122, 0xFDE5380C, 0xA4BEEA44, 0x4BDECFA9, 0xF6BB4B60, 0xBEBFBC70,
+        0x289B7EC6, 0xEAA127FA, 0xD4EF3085, 0x04881D05, 0xD9D4D039, 0xE6DB99E5, 0x1FA27CF8, 0xC4AC5665,
+        0xF4292244, 0x432AFF97, 0xAB9423A7, 0xFC93A039, 0x655B59C3, 0x8F0CCC92, 0xFFEFF47D, 0x85845DD1,
+        0x6FA87E4F, 0xFE2CE6E0, 0xA3014314, 0x4E0811A1, 0xF7537E82, 0xBD3AF235, 0x2AD7D2BB, 0xEB86D391
+};
+
+static const uint32_t md5Shifts[64] = {
+        7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+        5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+        4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+        6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+static const uint32_t sha256InitialState[8] = {
+        0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+static const uint32_t sha256Constants[64] = {
+        0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+        0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+        0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+        0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+        0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+        0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+        0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+        0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#define LANES 8
+#define LANES_NAME(name) name##8
+#include "multihash_lanes.h"
+#undef LANES_NAME
+#undef LANES
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#define LANES 16
+#define LANES_NAME(name) name##16
+#include "multihash_lanes.h"
+#undef LANES_NAME
+#undef LANES
+#pragma GCC pop_options
+
+static uint32_t getLanesCount(void)
+{
+    static int lanesCount = -1;
+
+    if(lanesCount < 0)
+    {
+        __builtin_cpu_init();
+
+        if(__builtin_cpu_supports("avx512f"))
+        {
+            lanesCount = 16;
+        }
+        else if(__builtin_cpu_supports("avx2"))
+        {
+            lanesCount = 8;
+        }
+        else
+        {
+            lanesCount = 0;
+        }
+    }
+
+    return lanesCount;
+}
+
+#else
+
+static uint32_t getLanesCount(void)
+{
+    return 0;
+}
+
+#endif
+
+// Single-block words are grouped by lanesCount and hashed by the vector kernel, the others (and the leftovers when
+// too few lanes would be used) are hashed one by one with the scalar function.
+static void hashBatch(HashFunction f, LanesFunction lanes, uint32_t lanesCount, uint8_t digestSize,
+                      const unsigned char* const* words, const size_t* lengths, size_t count, unsigned char* digests)
+{
+    const unsigned char* laneWords[MULTIHASH_MAX_LANES];
+    size_t laneLengths[MULTIHASH_MAX_LANES];
+    unsigned char* laneDigests[MULTIHASH_MAX_LANES];
+    unsigned char scratch[MULTIHASH_MAX_LANES][MULTIHASH_BLOCK_SIZE];
+    uint32_t used = 0, lane;
+    size_t i;
+
+    for(i=0 ; i<count ; i++)
+    {
+        if((lanesCount == 0) || (lengths[i] > MULTIHASH_MAX_LENGTH))
+        {
+            f(words[i], lengths[i], digests + i * digestSize);
+            continue;
+        }
+
+        laneWords[used] = words[i];
+        laneLengths[used] = lengths[i];
+        laneDigests[used] = digests + i * digestSize;
+        used++;
+
+        if(used == lanesCount)
+        {
+            lanes(laneWords, laneLengths, laneDigests);
+            used = 0;
+        }
+    }
+
+    if(used > (lanesCount >> 2))
+    {
+        for(lane=used ; lane<lanesCount ; lane++)
+        {
+            laneWords[lane] = laneWords[0];
+            laneLengths[lane] = laneLengths[0];
+            laneDigests[lane] = scratch[lane];
+        }
+
+        lanes(laneWords, laneLengths, laneDigests);
+    }
+    else
+    {
+        for(lane=0 ; lane<used ; lane++)
+        {
+            f(laneWords[lane], laneLengths[lane], laneDigests[lane]);
+        }
+    }
+}
+
+void md5Batch(const unsigned char* const* words, const size_t* lengths, size_t count, unsigned char* digests)
+{
+    uint32_t lanesCount = getLanesCount();
+    LanesFunction lanes = NULL;
+
+#if defined(__x86_64__) || defined(__i386__)
+    lanes = (lanesCount == 16) ? md5Lanes16 : md5Lanes8;
+#endif
+
+    hashBatch(MD5, lanes, lanesCount, MD5_DIGEST_LENGTH, words, lengths, count, digests);
+}
+
+void sha1Batch(const unsigned char* const* words, const size_t* lengths, size_t count, unsigned char* digests)
+{
+    uint32_t lanesCount = getLanesCount();
+    LanesFunction lanes = NULL;
+
+#if defined(__x86_64__) || defined(__i386__)
+    lanes = (lanesCount == 16) ? sha1Lanes16 : sha1Lanes8;
+#endif
+
+    hashBatch(SHA1, lanes, lanesCount, SHA_DIGEST_LENGTH, words, lengths, count, digests);
+}
+
+void sha256Batch(const unsigned char* const* words, const size_t* lengths, size_t count, unsigned char* digests)
+{
+    uint32_t lanesCount = getLanesCount();
+    LanesFunction lanes = NULL;
+
+#if defined(__x86_64__) || defined(__i386__)
+    lanes = (lanesCount == 16) ? sha256Lanes16 : sha256Lanes8;
+#endif
+
+    hashBatch(SHA256, lanes, lanesCount, SHA256_DIGEST_LENGTH, words, lengths, count, digests);
+}
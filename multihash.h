@@ -0,0 +1,16 @@
+#ifndef MULTIHASH_H
+#define MULTIHASH_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define MULTIHASH_BLOCK_SIZE 64
+#define MULTIHASH_MAX_LENGTH 55 // Longest message fitting in a single padded block
+#define MULTIHASH_MAX_LANES 16
+
+void md5Batch(const unsigned char* const* words, const size_t* lengths, size_t count, unsigned char* digests);
+void sha1Batch(const unsigned char* const* words, const size_t* lengths, size_t count, unsigned char* digests);
+void sha256Batch(const unsigned char* const* words, const size_t* lengths, size_t count, unsigned char* digests);
+
+#endif //MULTIHASH_H
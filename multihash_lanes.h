@@ -0,0 +1,236 @@
+// Kernels hashing LANES single-block messages at once, one message per 32-bit vector lane. This file is included by
+// multihash.c once per vector width, with LANES and LANES_NAME(name) defined and the matching target enabled.
+
+#define VECTOR LANES_NAME(Vector)
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+typedef uint32_t VECTOR __attribute__((vector_size(LANES * sizeof(uint32_t))));
+
+static void LANES_NAME(loadBlocks)(const unsigned char* const* words, const size_t* lengths, int bigEndian, VECTOR* w)
+{
+    uint32_t m[16][LANES];
+    uint8_t block[MULTIHASH_BLOCK_SIZE];
+    uint64_t bitsLength;
+    uint32_t lane, i;
+
+    for(lane=0 ; lane<LANES ; lane++)
+    {
+        memset(block, 0x00, MULTIHASH_BLOCK_SIZE);
+        memcpy(block, words[lane], lengths[lane]);
+        block[lengths[lane]] = 0x80;
+
+        bitsLength = lengths[lane] << 3;
+
+        for(i=0 ; i<8 ; i++)
+        {
+            if(bigEndian)
+            {
+                block[MULTIHASH_BLOCK_SIZE - 1 - i] = bitsLength >> (i << 3);
+            }
+            else
+            {
+                block[MULTIHASH_BLOCK_SIZE - 8 + i] = bitsLength >> (i << 3);
+            }
+        }
+
+        for(i=0 ; i<16 ; i++)
+        {
+            memcpy(&m[i][lane], block + (i << 2), sizeof(uint32_t));
+
+            if(bigEndian)
+            {
+                m[i][lane] = __builtin_bswap32(m[i][lane]);
+            }
+        }
+    }
+
+    for(i=0 ; i<16 ; i++)
+    {
+        memcpy(&w[i], m[i], sizeof(VECTOR));
+    }
+}
+
+static void LANES_NAME(storeDigests)(const VECTOR* state, uint32_t stateSize, int bigEndian, unsigned char* const* digests)
+{
+    uint32_t s[8][LANES];
+    uint32_t lane, i, word;
+
+    for(i=0 ; i<stateSize ; i++)
+    {
+        memcpy(s[i], &state[i], sizeof(VECTOR));
+    }
+
+    for(lane=0 ; lane<LANES ; lane++)
+    {
+        for(i=0 ; i<stateSize ; i++)
+        {
+            word = bigEndian ? __builtin_bswap32(s[i][lane]) : s[i][lane];
+            memcpy(digests[lane] + (i << 2), &word, sizeof(uint32_t));
+        }
+    }
+}
+
+static void LANES_NAME(md5Lanes)(const unsigned char* const* words, const size_t* lengths, unsigned char* const* digests)
+{
+    VECTOR w[16], state[4], a, b, c, d, f;
+    uint32_t i, g;
+
+    LANES_NAME(loadBlocks)(words, lengths, 0, w);
+
+    a = (VECTOR) {0} + 0x67452301;
+    b = (VECTOR) {0} + 0xEFCDAB89;
+    c = (VECTOR) {0} + 0x98BADCFE;
+    d = (VECTOR) {0} + 0x10325476;
+
+    for(i=0 ; i<64 ; i++)
+    {
+        switch(i >> 4)
+        {
+            case 0:
+                f = d ^ (b & (c ^ d));
+                g = i;
+                break;
+
+            case 1:
+                f = c ^ (d & (b ^ c));
+                g = (5 * i + 1) & 0xF;
+                break;
+
+            case 2:
+                f = b ^ c ^ d;
+                g = (3 * i + 5) & 0xF;
+                break;
+
+            default:
+                f = c ^ (b | ~d);
+                g = (7 * i) & 0xF;
+                break;
+        }
+
+        f = f + a + md5Constants[i] + w[g];
+        a = d;
+        d = c;
+        c = b;
+        b = b + ROTL(f, md5Shifts[i]);
+    }
+
+    state[0] = a + 0x67452301;
+    state[1] = b + 0xEFCDAB89;
+    state[2] = c + 0x98BADCFE;
+    state[3] = d + 0x10325476;
+
+    LANES_NAME(storeDigests)(state, 4, 0, digests);
+}
+
+static void LANES_NAME(sha1Lanes)(const unsigned char* const* words, const size_t* lengths, unsigned char* const* digests)
+{
+    VECTOR w[16], state[5], a, b, c, d, e, f, tmp;
+    uint32_t t, k;
+
+    LANES_NAME(loadBlocks)(words, lengths, 1, w);
+
+    a = (VECTOR) {0} + 0x67452301;
+    b = (VECTOR) {0} + 0xEFCDAB89;
+    c = (VECTOR) {0} + 0x98BADCFE;
+    d = (VECTOR) {0} + 0x10325476;
+    e = (VECTOR) {0} + 0xC3D2E1F0;
+
+    for(t=0 ; t<80 ; t++)
+    {
+        if(t >= 16)
+        {
+            tmp = w[(t - 3) & 0xF] ^ w[(t - 8) & 0xF] ^ w[(t - 14) & 0xF] ^ w[t & 0xF];
+            w[t & 0xF] = ROTL(tmp, 1);
+        }
+
+        switch(t / 20)
+        {
+            case 0:
+                f = d ^ (b & (c ^ d));
+                k = 0x5A827999;
+                break;
+
+            case 1:
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+                break;
+
+            case 2:
+                f = (b & c) | (d & (b | c));
+                k = 0x8F1BBCDC;
+                break;
+
+            default:
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+                break;
+        }
+
+        tmp = ROTL(a, 5) + f + e + k + w[t & 0xF];
+        e = d;
+        d = c;
+        c = ROTL(b, 30);
+        b = a;
+        a = tmp;
+    }
+
+    state[0] = a + 0x67452301;
+    state[1] = b + 0xEFCDAB89;
+    state[2] = c + 0x98BADCFE;
+    state[3] = d + 0x10325476;
+    state[4] = e + 0xC3D2E1F0;
+
+    LANES_NAME(storeDigests)(state, 5, 1, digests);
+}
+
+static void LANES_NAME(sha256Lanes)(const unsigned char* const* words, const size_t* lengths, unsigned char* const* digests)
+{
+    VECTOR w[16], state[8], s0, s1, t1, t2;
+    uint32_t t, i;
+
+    LANES_NAME(loadBlocks)(words, lengths, 1, w);
+
+    for(i=0 ; i<8 ; i++)
+    {
+        state[i] = (VECTOR) {0} + sha256InitialState[i];
+    }
+
+    for(t=0 ; t<64 ; t++)
+    {
+        if(t >= 16)
+        {
+            s0 = w[(t - 15) & 0xF];
+            s0 = ROTR(s0, 7) ^ ROTR(s0, 18) ^ (s0 >> 3);
+            s1 = w[(t - 2) & 0xF];
+            s1 = ROTR(s1, 17) ^ ROTR(s1, 19) ^ (s1 >> 10);
+            w[t & 0xF] = w[t & 0xF] + s0 + w[(t - 7) & 0xF] + s1;
+        }
+
+        // state[0..7] hold a..h
+        s1 = ROTR(state[4], 6) ^ ROTR(state[4], 11) ^ ROTR(state[4], 25);
+        t1 = state[7] + s1 + (state[6] ^ (state[4] & (state[5] ^ state[6]))) + sha256Constants[t] + w[t & 0xF];
+        s0 = ROTR(state[0], 2) ^ ROTR(state[0], 13) ^ ROTR(state[0], 22);
+        t2 = s0 + ((state[0] & state[1]) | (state[2] & (state[0] | state[1])));
+
+        state[7] = state[6];
+        state[6] = state[5];
+        state[5] = state[4];
+        state[4] = state[3] + t1;
+        state[3] = state[2];
+        state[2] = state[1];
+        state[1] = state[0];
+        state[0] = t1 + t2;
+    }
+
+    for(i=0 ; i<8 ; i++)
+    {
+        state[i] += sha256InitialState[i];
+    }
+
+    LANES_NAME(storeDigests)(state, 8, 1, digests);
+}
+
+#undef ROTR
+#undef ROTL
+#undef VECTOR
@@ -16,15 +16,15 @@ typedef struct {
 
 int main(int argc, char** argv)
 {
-    FILE* wordlistFile = NULL;
-    char line[MAX_LINE_SIZE] = {0};
-    char* tmp;
+    WordlistReader wordlist;
+    const char* line;
     uint8_t minDataBits, minIndex = 0;
     uint32_t i;
     uint64_t minIndexSize = -1;
     size_t lineLength, compressedBits;
     WordType wordType;
     IndexStats* stats = NULL;
+    int ret;
 
     if(argc != 2)
     {
@@ -32,58 +32,38 @@ int main(int argc, char** argv)
         return EXIT_FAILURE;
     }
 
-    wordlistFile = fopen(argv[1], "r");
-
-    if(wordlistFile == NULL)
+    if(openWordlist(argv[1], &wordlist))
     {
         printf("Unable to open the wordlist file.\n");
         return EXIT_FAILURE;
     }
 
-    minDataBits = getMinDataBits(wordlistFile);
+    minDataBits = getMinDataBits(wordlist.size);
     stats = malloc((MAX_DATA_BITS - minDataBits + 1) * sizeof(IndexStats));
 
     if(stats == NULL)
     {
         printf("Error: Unable to allocate the stats array.\n");
 
-        fclose(wordlistFile);
+        closeWordlist(&wordlist);
         return EXIT_FAILURE;
     }
 
     memset(stats, 0x00, (MAX_DATA_BITS - minDataBits + 1) * sizeof(IndexStats));
 
-    while(fgets(line, MAX_LINE_SIZE, wordlistFile) != NULL)
+    while((ret = nextWord(&wordlist, &line, &lineLength)) > 0)
     {
-        tmp = memchr(line, '\r', MAX_LINE_SIZE);
-
-        if(tmp == NULL)
-        {
-            tmp = memchr(line, '\n', MAX_LINE_SIZE);
-        }
-
-        if(tmp == NULL)
-        {
-            printf("Error: the line is too long (larger than %u characters).\n", MAX_LINE_SIZE - 1);
-
-            fclose(wordlistFile);
-            return EXIT_FAILURE;
-        }
-
-        *tmp = '\0';
-        lineLength = tmp - line;
-
-        if(isNumeric(line))
+        if(isNumeric(line, lineLength))
         {
             compressedBits = NUMERIC_COMPRESSED_BITS(lineLength) + NUMERIC_SYMBOL_BITS;
             wordType = NUMERIC;
         }
-        else if(isAlphanumeric(line))
+        else if(isAlphanumeric(line, lineLength))
         {
             compressedBits = ALPHANUMERIC_COMPRESSED_BITS(lineLength) + ALPHANUMERIC_SYMBOL_BITS;
             wordType = ALPHANUMERIC;
         }
-        else if(isReducedASCII(line))
+        else if(isReducedASCII(line, lineLength))
         {
             compressedBits = REDUCED_ASCII_COMPRESSED_BITS(lineLength) + REDUCED_ASCII_SYMBOL_BITS;
             wordType = REDUCED_ASCII;
@@ -111,6 +91,15 @@ int main(int argc, char** argv)
         }
     }
 
+    if(ret < 0)
+    {
+        printf("Error: the line is too long (larger than %u characters).\n", MAX_LINE_SIZE - 1);
+
+        free(stats);
+        closeWordlist(&wordlist);
+        return EXIT_FAILURE;
+    }
+
     for(i=0 ; i<=MAX_DATA_BITS - minDataBits ; i++)
     {
         if(stats[i].size <= minIndexSize)
@@ -131,10 +120,11 @@ int main(int argc, char** argv)
     printf("\t+ numeric: %lu\n", stats[minIndex].pointerTypes[NUMERIC]);
     printf("\t+ alphanumeric: %lu\n", stats[minIndex].pointerTypes[ALPHANUMERIC]);
     printf("\t+ reduced ASCII: %lu\n", stats[minIndex].pointerTypes[REDUCED_ASCII]);
-    printf("+ size (in bytes): %lu\n", stats[minIndex].size + sizeof(IndexHeader));
+    printf("+ size (in bytes): %lu\n", stats[minIndex].size + sizeof(IndexHeader) + INDEX_DIRECTORY_SIZE);
     printf("====================================\n");
 
-    fclose(wordlistFile);
+    free(stats);
+    closeWordlist(&wordlist);
 
     return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -0,0 +1,155 @@
+#include <sys/mman.h>
+
+#include "searchtree.h"
+#include "index.h"
+
+#define SEARCH_TREE_FANOUT (SEARCH_TREE_NODE_KEYS + 1)
+
+typedef uint64_t NodeKeys __attribute__((vector_size(SEARCH_TREE_NODE_KEYS * sizeof(uint64_t))));
+typedef int64_t NodeMask __attribute__((vector_size(SEARCH_TREE_NODE_KEYS * sizeof(int64_t))));
+
+static uint64_t* getNode(const SearchTree* tree, uint32_t layer, uint64_t node)
+{
+    return tree->keys + (tree->layerOffsets[layer] + node) * SEARCH_TREE_NODE_KEYS;
+}
+
+// Smallest key in the subtree of a child of a node of the layer. The padding after the last sample is above every key.
+static uint64_t getSubtreeKey(const SearchTree* tree, uint32_t layer, uint64_t child)
+{
+    uint32_t i;
+
+    for(i=layer ; i>1 ; i--)
+    {
+        child *= SEARCH_TREE_FANOUT;
+    }
+
+    return (child * SEARCH_TREE_NODE_KEYS < tree->samplesCount) ? getNode(tree, 0, child)[0] : UINT64_MAX;
+}
+
+// Nodes of each layer of the tree of samplesCount samples, from the bottom one. Returns the height of the tree.
+static uint32_t getLayerNodes(uint64_t samplesCount, uint64_t* layerNodes)
+{
+    uint32_t height = 1;
+
+    layerNodes[0] = (samplesCount + SEARCH_TREE_NODE_KEYS - 1) / SEARCH_TREE_NODE_KEYS;
+
+    while(layerNodes[height - 1] > 1)
+    {
+        layerNodes[height] = (layerNodes[height - 1] + SEARCH_TREE_FANOUT - 1) / SEARCH_TREE_FANOUT;
+        height++;
+    }
+
+    return height;
+}
+
+// Memory the tree of an index of indexesCount entries takes
+uint64_t getSearchTreeSize(uint64_t indexesCount)
+{
+    uint64_t layerNodes[SEARCH_TREE_MAX_HEIGHT], nodesCount = 0;
+    uint32_t layer, height;
+
+    height = getLayerNodes((indexesCount + SEARCH_TREE_BLOCK_ENTRIES - 1) / SEARCH_TREE_BLOCK_ENTRIES, layerNodes);
+
+    for(layer=0 ; layer<height ; layer++)
+    {
+        nodesCount += layerNodes[layer];
+    }
+
+    return nodesCount * SEARCH_TREE_NODE_KEYS * sizeof(uint64_t);
+}
+
+// The tree is built once the index is loaded, in an anonymous mapping so its nodes are aligned on cache lines
+int buildSearchTree(SearchTree* tree, const uint8_t* index, uint64_t indexesCount, uint8_t indexEntrySize,
+                    int hugePages)
+{
+    uint64_t layerNodes[SEARCH_TREE_MAX_HEIGHT], nodesCount = 0, node, i;
+    uint32_t layer, key;
+
+    memset(tree, 0x00, sizeof(SearchTree));
+
+    tree->samplesCount = (indexesCount + SEARCH_TREE_BLOCK_ENTRIES - 1) / SEARCH_TREE_BLOCK_ENTRIES;
+    tree->height = getLayerNodes(tree->samplesCount, layerNodes);
+
+    // The root layer comes first, so the top of the tree shares the same few pages
+    for(layer=tree->height ; layer>0 ; layer--)
+    {
+        tree->layerOffsets[layer - 1] = nodesCount;
+        nodesCount += layerNodes[layer - 1];
+    }
+
+    tree->size = nodesCount * SEARCH_TREE_NODE_KEYS * sizeof(uint64_t);
+    tree->keys = mmap(NULL, tree->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if(tree->keys == MAP_FAILED)
+    {
+        tree->keys = NULL;
+        return 1;
+    }
+
+    if(hugePages)
+    {
+        madvise(tree->keys, tree->size, MADV_HUGEPAGE);
+    }
+
+    for(i=0 ; i<layerNodes[0] * SEARCH_TREE_NODE_KEYS ; i++)
+    {
+        getNode(tree, 0, 0)[i] = (i < tree->samplesCount)
+                                 ? getEntryKey(index + i * SEARCH_TREE_BLOCK_ENTRIES * indexEntrySize)
+                                 : UINT64_MAX;
+    }
+
+    for(layer=1 ; layer<tree->height ; layer++)
+    {
+        for(node=0 ; node<layerNodes[layer] ; node++)
+        {
+            for(key=0 ; key<SEARCH_TREE_NODE_KEYS ; key++)
+            {
+                getNode(tree, layer, node)[key] = getSubtreeKey(tree, layer, node * SEARCH_TREE_FANOUT + key + 1);
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Keys of the node below key, compared all at once
+static inline uint32_t rankNode(const uint64_t* node, uint64_t key)
+{
+    NodeMask below = *(const NodeKeys*) node < ((NodeKeys) {0} + key);
+    uint32_t i, rank = 0;
+
+    for(i=0 ; i<SEARCH_TREE_NODE_KEYS ; i++)
+    {
+        rank -= below[i];
+    }
+
+    return rank;
+}
+
+// Index of the first sampled key not below key, samplesCount if there is none
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target_clones("avx512f", "avx2", "default")))
+#endif
+uint64_t searchTree(const SearchTree* tree, uint64_t key)
+{
+    uint64_t node = 0;
+    uint32_t layer;
+
+    for(layer=tree->height - 1 ; layer>0 ; layer--)
+    {
+        node = node * SEARCH_TREE_FANOUT + rankNode(getNode(tree, layer, node), key);
+    }
+
+    node = node * SEARCH_TREE_NODE_KEYS + rankNode(getNode(tree, 0, node), key);
+
+    return (node < tree->samplesCount) ? node : tree->samplesCount;
+}
+
+void freeSearchTree(SearchTree* tree)
+{
+    if(tree->keys != NULL)
+    {
+        munmap(tree->keys, tree->size);
+        tree->keys = NULL;
+    }
+}
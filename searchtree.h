@@ -0,0 +1,29 @@
+#ifndef SEARCHTREE_H
+#define SEARCHTREE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SEARCH_TREE_NODE_KEYS 8 // A node is one 64 bytes cache line
+#define SEARCH_TREE_BLOCK_ENTRIES 16 // Index entries below each key of the tree
+#define SEARCH_TREE_MAX_HEIGHT 24
+
+// Static B+ tree over the hash of one index entry every SEARCH_TREE_BLOCK_ENTRIES. The nodes are stored layer by
+// layer, the child i of the node k is the node k * (SEARCH_TREE_NODE_KEYS + 1) + i of the layer below, so a search
+// touches one cache line per layer and the bottom layer gives the position of the block in the index.
+typedef struct {
+    uint64_t* keys;
+    uint64_t size;
+    uint64_t samplesCount;
+    uint32_t height;
+    uint64_t layerOffsets[SEARCH_TREE_MAX_HEIGHT];
+} SearchTree;
+
+int buildSearchTree(SearchTree* tree, const uint8_t* index, uint64_t indexesCount, uint8_t indexEntrySize,
+                    int hugePages);
+uint64_t getSearchTreeSize(uint64_t indexesCount);
+uint64_t searchTree(const SearchTree* tree, uint64_t key);
+void freeSearchTree(SearchTree* tree);
+
+#endif //SEARCHTREE_H
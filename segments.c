@@ -0,0 +1,309 @@
+#include <unistd.h>
+
+#include "segments.h"
+#include "defines.h"
+
+// Returns 1 if the first line of the file is MANIFEST_HEADER
+int isManifest(const char* path)
+{
+    char line[sizeof(MANIFEST_HEADER) + 1];
+    FILE* f = fopen(path, "r");
+    int manifest;
+
+    if(f == NULL)
+    {
+        return 0;
+    }
+
+    manifest = (fgets(line, sizeof(line), f) != NULL) && (strncmp(line, MANIFEST_HEADER, strlen(MANIFEST_HEADER)) == 0)
+               && ((line[strlen(MANIFEST_HEADER)] == '\n') || (line[strlen(MANIFEST_HEADER)] == '\r')
+                   || (line[strlen(MANIFEST_HEADER)] == '\0'));
+
+    fclose(f);
+
+    return manifest;
+}
+
+// Returns 1 if the manifest cannot be opened, 2 if it is invalid
+int readManifest(const char* path, Manifest* manifest)
+{
+    const char* slash = strrchr(path, '/');
+    size_t directoryLength = (slash == NULL) ? 0 : slash + 1 - path, length;
+    char line[MAX_LINE_SIZE];
+    FILE* f = fopen(path, "r");
+    int error = 0, header = 0;
+    char* name, *segmentPath;
+
+    memset(manifest, 0x00, sizeof(Manifest));
+
+    if(f == NULL)
+    {
+        return 1;
+    }
+
+    while(!error && (fgets(line, sizeof(line), f) != NULL))
+    {
+        length = strcspn(line, "\r\n");
+        line[length] = '\0';
+
+        if(!header)
+        {
+            header = 1;
+            error = (strcmp(line, MANIFEST_HEADER) != 0);
+            continue;
+        }
+
+        if((length == 0) || (line[0] == '#'))
+        {
+            continue;
+        }
+
+        name = strdup(line);
+        segmentPath = malloc(directoryLength + length + 1);
+
+        if((name == NULL) || (segmentPath == NULL) || (manifest->count == MAX_SEGMENTS))
+        {
+            free(name);
+            free(segmentPath);
+            error = 1;
+            break;
+        }
+
+        if(line[0] == '/')
+        {
+            strcpy(segmentPath, line);
+        }
+        else
+        {
+            sprintf(segmentPath, "%.*s%s", (int) directoryLength, path, line);
+        }
+
+        manifest->names[manifest->count] = name;
+        manifest->paths[manifest->count] = segmentPath;
+        manifest->count++;
+    }
+
+    fclose(f);
+
+    if(error || !header)
+    {
+        freeManifest(manifest);
+        return 2;
+    }
+
+    return 0;
+}
+
+// The new manifest is written aside then renamed over the old one, so a reader sees either of them whole
+int writeManifest(const char* path, Manifest* manifest)
+{
+    char* tmpPath = malloc(strlen(path) + sizeof(MANIFEST_TMP_SUFFIX));
+    FILE* f;
+    uint32_t i;
+    int error;
+
+    if(tmpPath == NULL)
+    {
+        return 1;
+    }
+
+    sprintf(tmpPath, "%s%s", path, MANIFEST_TMP_SUFFIX);
+    f = fopen(tmpPath, "w");
+
+    if(f == NULL)
+    {
+        free(tmpPath);
+        return 1;
+    }
+
+    error = (fprintf(f, "%s\n", MANIFEST_HEADER) < 0);
+
+    for(i=0 ; i<manifest->count ; i++)
+    {
+        error |= (fprintf(f, "%s\n", manifest->names[i]) < 0);
+    }
+
+    error |= fflush(f) || fsync(fileno(f));
+    error |= fclose(f);
+    error = error || rename(tmpPath, path);
+
+    if(error)
+    {
+        unlink(tmpPath);
+    }
+
+    free(tmpPath);
+
+    return error;
+}
+
+void freeManifest(Manifest* manifest)
+{
+    uint32_t i;
+
+    for(i=0 ; i<manifest->count ; i++)
+    {
+        free(manifest->names[i]);
+        free(manifest->paths[i]);
+    }
+
+    manifest->count = 0;
+}
+
+// Opens a manifest, or a single index file as an index of one segment. Returns the errors of openIndexTable for the
+// segment manifest.paths[segmentsCount], 4 if the manifest is invalid and 5 if the segment does not have the hash
+// function of the first one.
+int openSegmentedIndex(const char* path, SegmentedIndex* index)
+{
+    int error;
+
+    memset(index, 0x00, sizeof(SegmentedIndex));
+
+    if(isManifest(path))
+    {
+        if(readManifest(path, &index->manifest))
+        {
+            return 4;
+        }
+    }
+    else
+    {
+        index->manifest.names[0] = strdup(path);
+        index->manifest.paths[0] = strdup(path);
+        index->manifest.count = 1;
+
+        if((index->manifest.names[0] == NULL) || (index->manifest.paths[0] == NULL))
+        {
+            return 1;
+        }
+    }
+
+    if(index->manifest.count == 0)
+    {
+        return 4;
+    }
+
+    index->segments = calloc(index->manifest.count, sizeof(IndexTable));
+
+    if(index->segments == NULL)
+    {
+        return 1;
+    }
+
+    for( ; index->segmentsCount<index->manifest.count ; index->segmentsCount++)
+    {
+        error = openIndexTable(index->manifest.paths[index->segmentsCount], &index->segments[index->segmentsCount]);
+
+        if(!error && (strncmp(index->segments[index->segmentsCount].header.hashName, index->segments[0].header.hashName,
+                              MAX_HASH_NAME_SIZE) != 0))
+        {
+            error = 5;
+        }
+
+        if(error)
+        {
+            closeIndexTable(&index->segments[index->segmentsCount]);
+            return error;
+        }
+    }
+
+    index->hashInfos = index->segments[0].hashInfos;
+    memcpy(index->hashName, index->segments[0].header.hashName, MAX_HASH_NAME_SIZE);
+
+    return 0;
+}
+
+uint64_t getSegmentedIndexAllocation(SegmentedIndex* index, uint32_t flags)
+{
+    uint64_t allocation = 0;
+    uint32_t i;
+
+    for(i=0 ; i<index->segmentsCount ; i++)
+    {
+        allocation += getIndexTableAllocation(&index->segments[i], flags);
+    }
+
+    return allocation;
+}
+
+int loadSegmentedIndex(SegmentedIndex* index, uint32_t flags)
+{
+    uint32_t i;
+
+    for(i=0 ; i<index->segmentsCount ; i++)
+    {
+        if(loadIndexTable(&index->segments[i], flags))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void closeSegmentedIndex(SegmentedIndex* index)
+{
+    uint32_t i;
+
+    for(i=0 ; i<index->segmentsCount ; i++)
+    {
+        closeIndexTable(&index->segments[i]);
+    }
+
+    free(index->segments);
+    index->segments = NULL;
+    index->segmentsCount = 0;
+
+    freeManifest(&index->manifest);
+}
+
+// Looks the digests up in the newest segment, then retries the misses on the older ones until all are found or every
+// segment is searched. The misses go by chunks of SEGMENTS_BATCH_SIZE, still searched by batches in each segment.
+void lookupSegmentsBatch(SegmentedIndex* index, uint8_t* digestTmp, const uint8_t* digests, uint32_t count,
+                         uint8_t* const* outs, size_t* outlens)
+{
+    uint8_t missDigests[SEGMENTS_BATCH_SIZE * MAX_DIGEST_SIZE];
+    uint8_t* missOuts[SEGMENTS_BATCH_SIZE];
+    size_t missLengths[SEGMENTS_BATCH_SIZE];
+    uint32_t misses[SEGMENTS_BATCH_SIZE];
+    uint8_t digestSize = index->hashInfos.digestSize;
+    uint32_t chunk, chunkCount, missCount, kept, i, segment;
+
+    lookupBatch(&index->segments[index->segmentsCount - 1], digestTmp, digests, count, outs, outlens);
+
+    for(chunk=0 ; (chunk<count) && (index->segmentsCount > 1) ; chunk+=SEGMENTS_BATCH_SIZE)
+    {
+        chunkCount = (count - chunk < SEGMENTS_BATCH_SIZE) ? count - chunk : SEGMENTS_BATCH_SIZE;
+
+        for(i=chunk, missCount=0 ; i<chunk+chunkCount ; i++)
+        {
+            if(outlens[i] == LOOKUP_NOT_FOUND)
+            {
+                memcpy(missDigests + missCount * digestSize, digests + i * digestSize, digestSize);
+                missOuts[missCount] = outs[i];
+                misses[missCount++] = i;
+            }
+        }
+
+        for(segment=index->segmentsCount-1 ; (segment>0) && (missCount > 0) ; segment--)
+        {
+            lookupBatch(&index->segments[segment - 1], digestTmp, missDigests, missCount, missOuts, missLengths);
+
+            // The found ones are answered, the others are kept for the next segment
+            for(i=0, kept=0 ; i<missCount ; i++)
+            {
+                if(missLengths[i] != LOOKUP_NOT_FOUND)
+                {
+                    outlens[misses[i]] = missLengths[i];
+                    continue;
+                }
+
+                memmove(missDigests + kept * digestSize, missDigests + i * digestSize, digestSize);
+                missOuts[kept] = missOuts[i];
+                misses[kept++] = misses[i];
+            }
+
+            missCount = kept;
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef SEGMENTS_H
+#define SEGMENTS_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "index.h"
+#include "hash.h"
+#include "table.h"
+
+#define MAX_SEGMENTS 64
+#define MANIFEST_HEADER "#segments" // First line of a manifest
+#define MANIFEST_TMP_SUFFIX ".tmp"
+#define SEGMENTS_BATCH_SIZE 256 // Misses of a batch retried together on the older segments
+
+// Sorted index files served as one index, listed one per line after MANIFEST_HEADER, oldest first. The other lines
+// starting with '#' and the empty ones are ignored. A relative path is relative to the directory of the manifest.
+typedef struct {
+    char* names[MAX_SEGMENTS]; // As written in the manifest
+    char* paths[MAX_SEGMENTS];
+    uint32_t count;
+} Manifest;
+
+// The segments of an index, all of the same hash function. A lookup goes from the newest segment to the oldest one.
+typedef struct {
+    Manifest manifest;
+    IndexTable* segments;
+    uint32_t segmentsCount;
+    HashInfos hashInfos;
+    char hashName[MAX_HASH_NAME_SIZE];
+} SegmentedIndex;
+
+int isManifest(const char* path);
+int readManifest(const char* path, Manifest* manifest);
+int writeManifest(const char* path, Manifest* manifest);
+void freeManifest(Manifest* manifest);
+
+int openSegmentedIndex(const char* path, SegmentedIndex* index);
+uint64_t getSegmentedIndexAllocation(SegmentedIndex* index, uint32_t flags);
+int loadSegmentedIndex(SegmentedIndex* index, uint32_t flags);
+void closeSegmentedIndex(SegmentedIndex* index);
+
+void lookupSegmentsBatch(SegmentedIndex* index, uint8_t* digestTmp, const uint8_t* digests, uint32_t count,
+                         uint8_t* const* outs, size_t* outlens);
+
+#endif //SEGMENTS_H
@@ -2,30 +2,96 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 #include "index.h"
+#include "sorting.h"
+#include "merging.h"
+#include "dedup.h"
+#include "filter.h"
 #include "defines.h"
 
-void mergeSort(uint8_t* sortBuffer, uint8_t* workBuffer, uint64_t l, uint64_t u, uint8_t indexEntrySize);
-void merge(const uint8_t* in, uint8_t* out, uint64_t l, uint64_t m, uint64_t u, uint8_t indexEntrySize);
-
-void loadFileToBuffer(FILE* file, uint8_t* buffer, uint64_t indexesCount, uint8_t indexEntrySize);
-void writeBufferToFile(FILE* file, uint8_t* buffer, uint64_t indexesCount, uint8_t indexEntrySize);
+typedef struct {
+    int fd;
+    uint64_t offset;
+    size_t size;
+    uint8_t* buffer;
+    int error;
+} RunLoad;
+
+void loadFileToBuffer(FILE* file, uint64_t entriesOffset, uint8_t* buffer, uint64_t indexesCount, uint8_t indexEntrySize);
+void writeBufferToFile(FILE* file, uint64_t entriesOffset, uint8_t* buffer, uint64_t indexesCount, uint8_t indexEntrySize);
+int sortInMemory(FILE* indexFile, uint64_t entriesOffset, uint64_t indexesCount, uint8_t indexEntrySize,
+                 SortAlgorithm algorithm, uint32_t threadsCount);
+uint64_t getRunEntriesCount(uint64_t run, uint64_t runEntries, uint64_t indexesCount);
+int sortExternal(FILE* indexFile, const char* indexPath, uint64_t entriesOffset, uint64_t indexesCount,
+                 uint8_t indexEntrySize, uint64_t memory, SortAlgorithm algorithm, uint32_t threadsCount);
+int deduplicateIndex(FILE* indexFile, const char* indexPath, IndexHeader* indexHeader);
 
 int main(int argc, char** argv)
 {
     FILE* indexFile;
-    uint64_t bufSize, indexesCount;
+    uint64_t bufSize, indexesCount, memory = 0;
+    uint32_t threadsCount = 1;
+    SortAlgorithm algorithm = SORT_RADIX;
     uint8_t indexEntrySize, answer;
-    uint8_t* sortBuffer, *workBuffer;
     IndexHeader indexHeader;
+    FilterHeader filterHeader;
+    double falsePositiveRate = 0;
+    int i, error, deduplicate = 0;
 
-    if(argc != 2)
+    if(argc < 2)
     {
-        printf("Usage: %s <index_file>\n", argv[0]);
+        printf("Usage: %s <index_file> [--memory <MiB>] [--threads <count>] [--algorithm radix|merge|inplace] [--dedup] "
+               "[--filter <false_positive_rate>]\n", argv[0]);
         return EXIT_FAILURE;
     }
 
+    for(i=2 ; i<argc ; i++)
+    {
+        if((strcmp(argv[i], "--memory") == 0) && (i + 1 < argc))
+        {
+            memory = strtol(argv[++i], NULL, 10) * (uint64_t) MIB;
+        }
+        else if((strcmp(argv[i], "--threads") == 0) && (i + 1 < argc))
+        {
+            threadsCount = strtol(argv[++i], NULL, 10);
+
+            // 0 uses every online core
+            if(threadsCount == 0)
+            {
+                threadsCount = sysconf(_SC_NPROCESSORS_ONLN);
+            }
+        }
+        else if((strcmp(argv[i], "--algorithm") == 0) && (i + 1 < argc))
+        {
+            if(getSortAlgorithm(argv[++i], &algorithm))
+            {
+                printf("Unknown sort algorithm: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if(strcmp(argv[i], "--dedup") == 0)
+        {
+            deduplicate = 1;
+        }
+        else if((strcmp(argv[i], "--filter") == 0) && (i + 1 < argc))
+        {
+            if(parseFalsePositiveRate(argv[++i], &falsePositiveRate))
+            {
+                printf("The false positive rate must be between 0 and 1: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else
+        {
+            printf("Unknown option: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
     indexFile = fopen(argv[1], "r+");
 
     if(indexFile == NULL)
@@ -44,98 +110,397 @@ int main(int argc, char** argv)
 
     indexEntrySize = getIndexEntrySize(&indexHeader);
     indexesCount = getIndexesCount(&indexHeader);
-    bufSize = indexEntrySize * indexesCount;
+    // The sort buffer, and the work buffer unless the sort is in place
+    bufSize = indexEntrySize * indexesCount * (needsSortWork(algorithm) ? 2 : 1);
 
-    printf("WARNING: This program will allocate %lu MiB of RAM. Do you want to continue? (y/N)\n", (2 * bufSize) / MIB);
-    answer = getchar();
+    // With a memory budget the user already chose how much RAM to use, and nobody can answer the prompt without a tty
+    if((memory == 0) && isatty(STDIN_FILENO))
+    {
+        printf("WARNING: This program will allocate %lu MiB of RAM. Do you want to continue? (y/N)\n", bufSize / MIB);
+        answer = getchar();
+
+        if((answer != 'y') && (answer != 'Y'))
+        {
+            printf("ABORTING\n");
+
+            fclose(indexFile);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if((memory == 0) || (bufSize <= memory))
+    {
+        error = sortInMemory(indexFile, getIndexEntriesOffset(&indexHeader), indexesCount, indexEntrySize, algorithm,
+                             threadsCount);
+    }
+    else
+    {
+        error = sortExternal(indexFile, argv[1], getIndexEntriesOffset(&indexHeader), indexesCount, indexEntrySize, memory,
+                             algorithm, threadsCount);
+    }
 
-    if((answer != 'y') && (answer != 'Y'))
+    if(!error && deduplicate)
     {
-        printf("ABORTING\n");
+        error = deduplicateIndex(indexFile, argv[1], &indexHeader);
+    }
 
-        fclose(indexFile);
-        return EXIT_FAILURE;
+    if(!error && updateIndexDirectory(indexFile))
+    {
+        printf("Unable to write the index directory.\n");
+        error = 1;
     }
 
+    fclose(indexFile);
+
+    // The filter is built once the index is written, so it is not older than the index
+    if(!error && (falsePositiveRate != 0))
+    {
+        if(writeIndexFilter(argv[1], falsePositiveRate, &filterHeader))
+        {
+            printf("Unable to write the index filter.\n");
+            error = 1;
+        }
+        else
+        {
+            printIndexFilterCost(&filterHeader);
+        }
+    }
+
+    return error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int sortInMemory(FILE* indexFile, uint64_t entriesOffset, uint64_t indexesCount, uint8_t indexEntrySize,
+                 SortAlgorithm algorithm, uint32_t threadsCount)
+{
+    uint64_t bufSize = indexEntrySize * indexesCount;
+    uint8_t* sortBuffer, *workBuffer;
+
     sortBuffer = malloc(bufSize);
 
     if(sortBuffer == NULL)
     {
         printf("Unable to allocate the sort buffer.\n");
-
-        fclose(indexFile);
-        return EXIT_FAILURE;
+        return 1;
     }
 
-    workBuffer = malloc(bufSize);
+    workBuffer = needsSortWork(algorithm) ? malloc(bufSize) : NULL;
 
-    if(workBuffer == NULL)
+    if((workBuffer == NULL) && needsSortWork(algorithm))
     {
         printf("Unable to allocate the merge buffer.\n");
 
         free(sortBuffer);
-        fclose(indexFile);
-        return EXIT_FAILURE;
+        return 1;
     }
 
-    loadFileToBuffer(indexFile, sortBuffer, indexesCount, indexEntrySize);
-    memcpy(workBuffer, sortBuffer, bufSize);
-
-    mergeSort(sortBuffer, workBuffer, 0, indexesCount, indexEntrySize);
+    loadFileToBuffer(indexFile, entriesOffset, sortBuffer, indexesCount, indexEntrySize);
+    sortIndexEntriesParallel(sortBuffer, workBuffer, indexesCount, indexEntrySize, algorithm, threadsCount);
 
-    writeBufferToFile(indexFile, sortBuffer, indexesCount, indexEntrySize);
+    writeBufferToFile(indexFile, entriesOffset, sortBuffer, indexesCount, indexEntrySize);
 
     free(sortBuffer);
     free(workBuffer);
-    fclose(indexFile);
 
-    return EXIT_SUCCESS;
+    return 0;
 }
 
-void mergeSort(uint8_t* sortBuffer, uint8_t* workBuffer, uint64_t l, uint64_t u, uint8_t indexEntrySize)
+void* loadRun(void* arg)
 {
-    uint64_t m;
+    RunLoad* load = arg;
+    size_t done = 0;
+    ssize_t readSize;
+
+    load->error = 0;
 
-    if(u - l <= 1)
+    while(done < load->size)
     {
-        return;
+        readSize = pread(load->fd, load->buffer + done, load->size - done, load->offset + done);
+
+        if(readSize <= 0)
+        {
+            load->error = 1;
+            break;
+        }
+
+        done += readSize;
     }
 
-    m = l + (u - l) / 2;
+    return NULL;
+}
 
-    mergeSort(workBuffer, sortBuffer, l, m, indexEntrySize);
-    mergeSort(workBuffer, sortBuffer, m, u, indexEntrySize);
+uint64_t getRunEntriesCount(uint64_t run, uint64_t runEntries, uint64_t indexesCount)
+{
+    uint64_t left = indexesCount - run * runEntries;
 
-    merge(workBuffer, sortBuffer, l, m, u, indexEntrySize);
+    return (left < runEntries) ? left : runEntries;
 }
 
-void merge(const uint8_t* in, uint8_t* out, uint64_t l, uint64_t m, uint64_t u, uint8_t indexEntrySize)
+// Sorts the index within memory bytes: runs of a third of the budget (a half for the in-place sort, which needs no work
+// buffer) are sorted and spilled to a runs file while the next run is loaded, then they are k-way merged back into the
+// index file.
+int sortExternal(FILE* indexFile, const char* indexPath, uint64_t entriesOffset, uint64_t indexesCount,
+                 uint8_t indexEntrySize, uint64_t memory, SortAlgorithm algorithm, uint32_t threadsCount)
 {
-    uint64_t i = l, j = m, k;
+    uint32_t buffersCount = needsSortWork(algorithm) ? 3 : 2;
+    uint64_t runEntries = memory / buffersCount / indexEntrySize, runsCount, offset = 0, i;
+    size_t runSize = runEntries * indexEntrySize, streamBufferSize;
+    uint8_t* memoryBuffer, *entry;
+    char* runsPath;
+    FILE* runsFile;
+    RunLoad loads[2], *current, *next;
+    pthread_t loader;
+    int loading;
+    EntryStream* streams;
+    EntryMerger merger;
+    EntryWriter output;
+    int error = 0;
+
+    if(runEntries == 0)
+    {
+        printf("The memory budget is too small.\n");
+        return 1;
+    }
+
+    runsCount = (indexesCount + runEntries - 1) / runEntries;
+    memoryBuffer = malloc(buffersCount * runSize);
+    streams = malloc(runsCount * sizeof(EntryStream));
+    runsPath = malloc(strlen(indexPath) + sizeof(RUNS_FILE_SUFFIX));
+
+    if((memoryBuffer == NULL) || (streams == NULL) || (runsPath == NULL))
+    {
+        printf("Unable to allocate the sort buffers.\n");
+
+        free(memoryBuffer);
+        free(streams);
+        free(runsPath);
+        return 1;
+    }
+
+    // The runs file is only reachable through its descriptor, so it goes away however the program ends
+    sprintf(runsPath, "%s%s", indexPath, RUNS_FILE_SUFFIX);
+    runsFile = fopen(runsPath, "w+");
+    unlink(runsPath);
+    free(runsPath);
+
+    if(runsFile == NULL)
+    {
+        printf("Unable to create the runs file.\n");
 
-    for(k=l ; k<u ; k++)
+        free(memoryBuffer);
+        free(streams);
+        return 1;
+    }
+
+    fflush(indexFile);
+
+    for(i=0 ; i<2 ; i++)
+    {
+        loads[i].fd = fileno(indexFile);
+        loads[i].buffer = memoryBuffer + i * runSize;
+    }
+
+    loads[0].offset = entriesOffset;
+    loads[0].size = getRunEntriesCount(0, runEntries, indexesCount) * indexEntrySize;
+    loadRun(&loads[0]);
+    error = loads[0].error;
+
+    for(i=0 ; (i<runsCount) && !error ; i++)
     {
-        if(i < m && (j >= u || (memcmp(in + i * indexEntrySize, in + j * indexEntrySize, INDEX_HASH_SIZE) < 0)))
+        current = &loads[i % 2];
+        next = &loads[(i + 1) % 2];
+        loading = 0;
+
+        if(i + 1 < runsCount)
         {
-            memcpy(out + k * indexEntrySize, in + i * indexEntrySize, indexEntrySize);
-            i++;
+            next->offset = current->offset + current->size;
+            next->size = getRunEntriesCount(i + 1, runEntries, indexesCount) * indexEntrySize;
+            loading = (pthread_create(&loader, NULL, loadRun, next) == 0);
+
+            if(!loading)
+            {
+                loadRun(next);
+            }
         }
-        else
+
+        sortIndexEntriesParallel(current->buffer, needsSortWork(algorithm) ? memoryBuffer + 2 * runSize : NULL,
+                                 current->size / indexEntrySize, indexEntrySize, algorithm, threadsCount);
+        error = (fwrite(current->buffer, current->size, 1, runsFile) != 1);
+
+        if(loading)
         {
-            memcpy(out + k * indexEntrySize, in + j * indexEntrySize, indexEntrySize);
-            j++;
+            pthread_join(loader, NULL);
+        }
+
+        if(i + 1 < runsCount)
+        {
+            error |= next->error;
         }
     }
+
+    if(error || fflush(runsFile))
+    {
+        printf("Unable to write the sorted runs.\n");
+
+        fclose(runsFile);
+        free(memoryBuffer);
+        free(streams);
+        return 1;
+    }
+
+    // The whole budget is now shared between the run streams and the output buffer
+    streamBufferSize = buffersCount * runSize / (runsCount + 1);
+
+    if(streamBufferSize < indexEntrySize)
+    {
+        printf("The memory budget is too small to merge %lu runs.\n", runsCount);
+
+        fclose(runsFile);
+        free(memoryBuffer);
+        free(streams);
+        return 1;
+    }
+
+    for(i=0 ; i<runsCount ; i++)
+    {
+        openEntryStream(&streams[i], fileno(runsFile), offset, getRunEntriesCount(i, runEntries, indexesCount),
+                        indexEntrySize, memoryBuffer + i * streamBufferSize, streamBufferSize);
+
+        offset += getRunEntriesCount(i, runEntries, indexesCount) * indexEntrySize;
+    }
+
+    if(initEntryMerger(&merger, streams, runsCount))
+    {
+        printf("Unable to allocate the merge heap.\n");
+
+        fclose(runsFile);
+        free(memoryBuffer);
+        free(streams);
+        return 1;
+    }
+
+    fseek(indexFile, entriesOffset, SEEK_SET);
+    initEntryWriter(&output, memoryBuffer + runsCount * streamBufferSize, streamBufferSize, indexFile);
+
+    while((entry = nextMergedEntry(&merger, NULL)) != NULL)
+    {
+        writeIndexEntry(entry, indexEntrySize, &output);
+    }
+
+    error = flushEntryWriter(&output);
+
+    if(error)
+    {
+        printf("Unable to write the index file.\n");
+    }
+
+    freeEntryMerger(&merger);
+    fclose(runsFile);
+    free(memoryBuffer);
+    free(streams);
+
+    return error;
+}
+
+// Rewrites the sorted index without its duplicate (hash, word) pairs, compacting the wordlist region. The entries are
+// read from a mapping of the file and written back behind the read position, the kept pointed words go through a
+// temporary file since the new wordlist region overlaps the old entries.
+int deduplicateIndex(FILE* indexFile, const char* indexPath, IndexHeader* indexHeader)
+{
+    uint64_t indexesCount = getIndexesCount(indexHeader), entriesOffset = getIndexEntriesOffset(indexHeader), fileSize;
+    uint64_t wordlistOffset, i;
+    uint8_t indexEntrySize = getIndexEntrySize(indexHeader);
+    uint8_t* mapped, *wordlist, *writeBuffer;
+    FILE* wordsFile;
+    char* wordsPath;
+    EntryWriter entries;
+    Deduplicator dedup;
+    int error;
+
+    fflush(indexFile);
+    fileSize = getFileSize(indexFile);
+    mapped = mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fileno(indexFile), 0);
+    writeBuffer = malloc(WRITE_BUFFER_SIZE);
+    wordsPath = malloc(strlen(indexPath) + sizeof(WORDS_FILE_SUFFIX));
+
+    if((mapped == MAP_FAILED) || (writeBuffer == NULL) || (wordsPath == NULL))
+    {
+        printf("Unable to set up the deduplication.\n");
+
+        if(mapped != MAP_FAILED)
+        {
+            munmap(mapped, fileSize);
+        }
+
+        free(writeBuffer);
+        free(wordsPath);
+        return 1;
+    }
+
+    sprintf(wordsPath, "%s%s", indexPath, WORDS_FILE_SUFFIX);
+    wordsFile = fopen(wordsPath, "w+");
+    unlink(wordsPath);
+    free(wordsPath);
+
+    fseek(indexFile, entriesOffset, SEEK_SET);
+    initEntryWriter(&entries, writeBuffer, WRITE_BUFFER_SIZE, indexFile);
+
+    if((wordsFile == NULL) || initDeduplicator(&dedup, indexHeader->dataBytes, &entries, wordsFile))
+    {
+        printf("Unable to set up the deduplication.\n");
+
+        if(wordsFile != NULL)
+        {
+            fclose(wordsFile);
+        }
+
+        munmap(mapped, fileSize);
+        free(writeBuffer);
+        return 1;
+    }
+
+    wordlist = mapped + entriesOffset + indexHeader->wordlistOffset;
+
+    for(i=0 ; i<indexesCount ; i++)
+    {
+        addDedupEntry(&dedup, mapped + entriesOffset + i * indexEntrySize, wordlist,
+                      fileSize - entriesOffset - indexHeader->wordlistOffset);
+    }
+
+    error = finishDeduplicator(&dedup);
+    error |= flushEntryWriter(&entries);
+
+    printf("%lu duplicate entries removed, %lu / %lu wordlist bytes kept.\n", dedup.removedEntries, dedup.wordlistSize,
+           fileSize - entriesOffset - indexHeader->wordlistOffset);
+
+    munmap(mapped, fileSize);
+    freeDeduplicator(&dedup);
+    free(writeBuffer);
+
+    wordlistOffset = ftell(indexFile) - entriesOffset;
+    error |= fflush(wordsFile) || copyFileTail(wordsFile, 0, indexFile);
+    fclose(wordsFile);
+
+    error |= fflush(indexFile) || ftruncate(fileno(indexFile), ftell(indexFile));
+
+    rewind(indexFile);
+    writeIndexHeader(indexFile, indexHeader->magic, indexHeader->hashName, indexHeader->dataBytes, wordlistOffset);
+
+    if(error)
+    {
+        printf("Unable to write the deduplicated index.\n");
+    }
+
+    return error;
 }
 
-void loadFileToBuffer(FILE* file, uint8_t* buffer, uint64_t indexesCount, uint8_t indexEntrySize)
+void loadFileToBuffer(FILE* file, uint64_t entriesOffset, uint8_t* buffer, uint64_t indexesCount, uint8_t indexEntrySize)
 {
-    fseek(file, sizeof(IndexHeader), SEEK_SET);
+    fseek(file, entriesOffset, SEEK_SET);
     fread(buffer, indexEntrySize, indexesCount, file);
 }
 
-void writeBufferToFile(FILE* file, uint8_t* buffer, uint64_t indexesCount, uint8_t indexEntrySize)
+void writeBufferToFile(FILE* file, uint64_t entriesOffset, uint8_t* buffer, uint64_t indexesCount, uint8_t indexEntrySize)
 {
-    fseek(file, sizeof(IndexHeader), SEEK_SET);
+    fseek(file, entriesOffset, SEEK_SET);
     fwrite(buffer, indexEntrySize, indexesCount, file);
 }
\ No newline at end of file
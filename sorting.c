@@ -0,0 +1,497 @@
+#include <pthread.h>
+
+#include "sorting.h"
+
+typedef struct {
+    uint8_t* src;
+    uint8_t* dst;
+    uint8_t* work;
+    uint64_t count;
+    uint8_t entrySize;
+    SortAlgorithm algorithm;
+    uint32_t threadsCount;
+    uint32_t index;
+    uint32_t width;
+    const uint64_t* bounds;
+    uint32_t* nextBucket;
+} SortTask;
+
+static void mergeSort(uint8_t* sortBuffer, uint8_t* workBuffer, uint64_t l, uint64_t u, uint8_t indexEntrySize);
+static void merge(const uint8_t* in, uint8_t* out, uint64_t l, uint64_t m, uint64_t u, uint8_t indexEntrySize);
+static void radixSort(uint8_t* entries, uint8_t* work, uint64_t count, uint8_t entrySize);
+static void americanFlagSort(uint8_t* entries, uint64_t count, uint8_t entrySize, int digit);
+static void countDigits(const uint8_t* entries, uint64_t count, uint8_t entrySize, int digit, uint64_t* counts);
+static void partitionEntries(uint8_t* entries, uint8_t entrySize, int digit, const uint64_t* counts);
+
+int getSortAlgorithm(const char* name, SortAlgorithm* algorithm)
+{
+    if(strcmp(name, "merge") == 0)
+    {
+        *algorithm = SORT_MERGE;
+    }
+    else if(strcmp(name, "radix") == 0)
+    {
+        *algorithm = SORT_RADIX;
+    }
+    else if(strcmp(name, "inplace") == 0)
+    {
+        *algorithm = SORT_IN_PLACE;
+    }
+    else
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+// The in-place sort does not use the work buffer, which can then be NULL
+int needsSortWork(SortAlgorithm algorithm)
+{
+    return algorithm != SORT_IN_PLACE;
+}
+
+// Sorts the entries on their hash. work must be as large as the entries, unless needsSortWork is false.
+void sortIndexEntries(uint8_t* entries, uint8_t* work, uint64_t count, uint8_t entrySize, SortAlgorithm algorithm)
+{
+    if(algorithm == SORT_IN_PLACE)
+    {
+        americanFlagSort(entries, count, entrySize, 0);
+        return;
+    }
+
+    if(algorithm == SORT_RADIX)
+    {
+        radixSort(entries, work, count, entrySize);
+        return;
+    }
+
+    memcpy(work, entries, count * entrySize);
+    mergeSort(entries, work, 0, count, entrySize);
+}
+
+// Start of the c-th of the threadsCount chunks the entries are split into
+static uint64_t getChunkStart(uint64_t count, uint32_t threadsCount, uint32_t c)
+{
+    return (c >= threadsCount) ? count : count * c / threadsCount;
+}
+
+// Sorts the buckets left by the first in-place pass, the threads taking the next unsorted bucket until none is left
+static void* sortBuckets(void* arg)
+{
+    SortTask* task = arg;
+    uint32_t bucket;
+
+    while((bucket = __sync_fetch_and_add(task->nextBucket, 1)) < 256)
+    {
+        americanFlagSort(task->src + task->bounds[bucket] * task->entrySize,
+                         task->bounds[bucket + 1] - task->bounds[bucket], task->entrySize, 1);
+    }
+
+    return NULL;
+}
+
+static void* sortChunk(void* arg)
+{
+    SortTask* task = arg;
+    uint64_t l = getChunkStart(task->count, task->threadsCount, task->index);
+    uint64_t u = getChunkStart(task->count, task->threadsCount, task->index + 1);
+
+    sortIndexEntries(task->src + l * task->entrySize, task->work + l * task->entrySize, u - l, task->entrySize,
+                     task->algorithm);
+
+    return NULL;
+}
+
+// Number of entries taken from a (of size m) among the first k entries of the merge of a and b (of size n), ties going
+// to a
+static uint64_t getSplitPoint(const uint8_t* a, uint64_t m, const uint8_t* b, uint64_t n, uint64_t k, uint8_t entrySize)
+{
+    uint64_t lo = (k > n) ? k - n : 0, hi = (k < m) ? k : m, i, j;
+
+    while(lo < hi)
+    {
+        i = lo + (hi - lo) / 2;
+        j = k - i;
+
+        if((j > 0) && (memcmp(a + i * entrySize, b + (j - 1) * entrySize, INDEX_HASH_SIZE) <= 0))
+        {
+            lo = i + 1;
+        }
+        else
+        {
+            hi = i;
+        }
+    }
+
+    return lo;
+}
+
+// Merges a and b in the output from its k0-th to its k1-th entry
+static void mergeRange(const uint8_t* a, uint64_t m, const uint8_t* b, uint64_t n, uint8_t* out, uint64_t k0, uint64_t k1,
+                       uint8_t entrySize)
+{
+    uint64_t i = getSplitPoint(a, m, b, n, k0, entrySize), j = k0 - i, k;
+
+    for(k=k0 ; k<k1 ; k++)
+    {
+        if((i < m) && ((j >= n) || (memcmp(a + i * entrySize, b + j * entrySize, INDEX_HASH_SIZE) <= 0)))
+        {
+            memcpy(out + k * entrySize, a + i * entrySize, entrySize);
+            i++;
+        }
+        else
+        {
+            memcpy(out + k * entrySize, b + j * entrySize, entrySize);
+            j++;
+        }
+    }
+}
+
+// Merges the pairs of sorted blocks of width chunks from src to dst. Each thread writes its own equal slice of the
+// output, whatever the pairs it overlaps.
+static void* mergeChunks(void* arg)
+{
+    SortTask* task = arg;
+    uint64_t s = getChunkStart(task->count, task->threadsCount, task->index);
+    uint64_t e = getChunkStart(task->count, task->threadsCount, task->index + 1);
+    uint64_t l, m, u;
+    uint32_t c;
+
+    for(c=0 ; c<task->threadsCount ; c+=2*task->width)
+    {
+        l = getChunkStart(task->count, task->threadsCount, c);
+        m = getChunkStart(task->count, task->threadsCount, c + task->width);
+        u = getChunkStart(task->count, task->threadsCount, c + 2 * task->width);
+
+        if((u <= s) || (l >= e))
+        {
+            continue;
+        }
+
+        mergeRange(task->src + l * task->entrySize, m - l, task->src + m * task->entrySize, u - m,
+                   task->dst + l * task->entrySize, ((s > l) ? s : l) - l, ((e < u) ? e : u) - l, task->entrySize);
+    }
+
+    return NULL;
+}
+
+// Runs f on threadsCount threads, the calling thread taking the first task
+static void runSortTasks(void* (*f)(void*), SortTask* tasks, pthread_t* threads, int* started, uint32_t threadsCount)
+{
+    uint32_t i;
+
+    for(i=1 ; i<threadsCount ; i++)
+    {
+        started[i] = (pthread_create(&threads[i], NULL, f, &tasks[i]) == 0);
+
+        if(!started[i])
+        {
+            f(&tasks[i]);
+        }
+    }
+
+    f(&tasks[0]);
+
+    for(i=1 ; i<threadsCount ; i++)
+    {
+        if(started[i])
+        {
+            pthread_join(threads[i], NULL);
+        }
+    }
+}
+
+// Same as sortIndexEntries on threadsCount threads: each thread sorts one chunk, then the chunks are merged pairwise,
+// every round being split evenly between the threads. The order on the hash is the same.
+void sortIndexEntriesParallel(uint8_t* entries, uint8_t* work, uint64_t count, uint8_t entrySize, SortAlgorithm algorithm,
+                              uint32_t threadsCount)
+{
+    SortTask* tasks;
+    pthread_t* threads;
+    int* started;
+    uint8_t* tmp;
+    uint32_t i, width;
+
+    uint64_t counts[256], bounds[257];
+    uint32_t nextBucket = 0;
+
+    if(count < threadsCount)
+    {
+        threadsCount = 1;
+    }
+
+    tasks = malloc(threadsCount * sizeof(SortTask));
+    threads = malloc(threadsCount * sizeof(pthread_t));
+    started = malloc(threadsCount * sizeof(int));
+
+    if((threadsCount <= 1) || (tasks == NULL) || (threads == NULL) || (started == NULL))
+    {
+        free(tasks);
+        free(threads);
+        free(started);
+        sortIndexEntries(entries, work, count, entrySize, algorithm);
+        return;
+    }
+
+    // The first byte splits the entries in 256 buckets that are sorted independently, so no work buffer is needed
+    if(algorithm == SORT_IN_PLACE)
+    {
+        countDigits(entries, count, entrySize, 0, counts);
+        partitionEntries(entries, entrySize, 0, counts);
+
+        for(i=0, bounds[0]=0 ; i<256 ; i++)
+        {
+            bounds[i + 1] = bounds[i] + counts[i];
+        }
+
+        for(i=0 ; i<threadsCount ; i++)
+        {
+            tasks[i].src = entries;
+            tasks[i].entrySize = entrySize;
+            tasks[i].bounds = bounds;
+            tasks[i].nextBucket = &nextBucket;
+        }
+
+        runSortTasks(sortBuckets, tasks, threads, started, threadsCount);
+
+        free(tasks);
+        free(threads);
+        free(started);
+        return;
+    }
+
+    for(i=0 ; i<threadsCount ; i++)
+    {
+        tasks[i].src = entries;
+        tasks[i].dst = work;
+        tasks[i].work = work;
+        tasks[i].count = count;
+        tasks[i].entrySize = entrySize;
+        tasks[i].algorithm = algorithm;
+        tasks[i].threadsCount = threadsCount;
+        tasks[i].index = i;
+    }
+
+    runSortTasks(sortChunk, tasks, threads, started, threadsCount);
+
+    for(width=1 ; width<threadsCount ; width*=2)
+    {
+        for(i=0 ; i<threadsCount ; i++)
+        {
+            tasks[i].width = width;
+        }
+
+        runSortTasks(mergeChunks, tasks, threads, started, threadsCount);
+
+        for(i=0 ; i<threadsCount ; i++)
+        {
+            tmp = tasks[i].src;
+            tasks[i].src = tasks[i].dst;
+            tasks[i].dst = tmp;
+        }
+    }
+
+    if(tasks[0].src != entries)
+    {
+        memcpy(entries, tasks[0].src, count * entrySize);
+    }
+
+    free(tasks);
+    free(threads);
+    free(started);
+}
+
+static void mergeSort(uint8_t* sortBuffer, uint8_t* workBuffer, uint64_t l, uint64_t u, uint8_t indexEntrySize)
+{
+    uint64_t m;
+
+    if(u - l <= 1)
+    {
+        return;
+    }
+
+    m = l + (u - l) / 2;
+
+    mergeSort(workBuffer, sortBuffer, l, m, indexEntrySize);
+    mergeSort(workBuffer, sortBuffer, m, u, indexEntrySize);
+
+    merge(workBuffer, sortBuffer, l, m, u, indexEntrySize);
+}
+
+static void merge(const uint8_t* in, uint8_t* out, uint64_t l, uint64_t m, uint64_t u, uint8_t indexEntrySize)
+{
+    uint64_t i = l, j = m, k;
+
+    for(k=l ; k<u ; k++)
+    {
+        if(i < m && (j >= u || (memcmp(in + i * indexEntrySize, in + j * indexEntrySize, INDEX_HASH_SIZE) < 0)))
+        {
+            memcpy(out + k * indexEntrySize, in + i * indexEntrySize, indexEntrySize);
+            i++;
+        }
+        else
+        {
+            memcpy(out + k * indexEntrySize, in + j * indexEntrySize, indexEntrySize);
+            j++;
+        }
+    }
+}
+
+// LSD radix sort on the INDEX_HASH_SIZE bytes of the big-endian hash, one byte per pass. The histograms of every byte
+// are built in a single pass, and the bytes shared by all the entries are skipped.
+static void radixSort(uint8_t* entries, uint8_t* work, uint64_t count, uint8_t entrySize)
+{
+    uint64_t counts[INDEX_HASH_SIZE][256], offset, tmp, i;
+    uint8_t* src = entries, *dst = work, *entry, *swap;
+    int digit, b;
+
+    if(count <= 1)
+    {
+        return;
+    }
+
+    memset(counts, 0x00, sizeof(counts));
+
+    for(i=0, entry=entries ; i<count ; i++, entry+=entrySize)
+    {
+        for(digit=0 ; digit<INDEX_HASH_SIZE ; digit++)
+        {
+            counts[digit][entry[digit]]++;
+        }
+    }
+
+    for(digit=INDEX_HASH_SIZE-1 ; digit>=0 ; digit--)
+    {
+        if(counts[digit][src[digit]] == count)
+        {
+            continue;
+        }
+
+        for(b=0, offset=0 ; b<256 ; b++)
+        {
+            tmp = counts[digit][b];
+            counts[digit][b] = offset;
+            offset += tmp;
+        }
+
+        for(i=0, entry=src ; i<count ; i++, entry+=entrySize)
+        {
+            memcpy(dst + counts[digit][entry[digit]]++ * entrySize, entry, entrySize);
+        }
+
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if(src != entries)
+    {
+        memcpy(entries, src, count * entrySize);
+    }
+}
+
+static void insertionSort(uint8_t* entries, uint64_t count, uint8_t entrySize)
+{
+    uint8_t tmp[INDEX_HASH_SIZE + MAX_DATA_SIZE];
+    uint64_t i, j;
+
+    for(i=1 ; i<count ; i++)
+    {
+        memcpy(tmp, entries + i * entrySize, entrySize);
+
+        for(j=i ; (j > 0) && (memcmp(entries + (j - 1) * entrySize, tmp, INDEX_HASH_SIZE) > 0) ; j--)
+        {
+            memcpy(entries + j * entrySize, entries + (j - 1) * entrySize, entrySize);
+        }
+
+        memcpy(entries + j * entrySize, tmp, entrySize);
+    }
+}
+
+// Permutes the entries into the 256 buckets of their digit-th hash byte by following the swap cycles. counts must hold
+// the size of every bucket.
+static void partitionEntries(uint8_t* entries, uint8_t entrySize, int digit, const uint64_t* counts)
+{
+    uint64_t heads[256], tails[256], offset;
+    uint8_t tmp[INDEX_HASH_SIZE + MAX_DATA_SIZE];
+    uint8_t* entry, *target;
+    int b;
+
+    for(b=0, offset=0 ; b<256 ; b++)
+    {
+        heads[b] = offset;
+        offset += counts[b];
+        tails[b] = offset;
+    }
+
+    for(b=0 ; b<256 ; b++)
+    {
+        while(heads[b] < tails[b])
+        {
+            entry = entries + heads[b] * entrySize;
+
+            if(entry[digit] == b)
+            {
+                heads[b]++;
+                continue;
+            }
+
+            target = entries + heads[entry[digit]]++ * entrySize;
+
+            memcpy(tmp, target, entrySize);
+            memcpy(target, entry, entrySize);
+            memcpy(entry, tmp, entrySize);
+        }
+    }
+}
+
+static void countDigits(const uint8_t* entries, uint64_t count, uint8_t entrySize, int digit, uint64_t* counts)
+{
+    uint64_t i;
+
+    memset(counts, 0x00, 256 * sizeof(uint64_t));
+
+    for(i=0 ; i<count ; i++)
+    {
+        counts[entries[i * entrySize + digit]]++;
+    }
+}
+
+// In-place MSD radix sort: the entries are partitioned on the digit-th hash byte, then every bucket is sorted on the
+// next byte. Only the bucket counters are needed on top of the entries.
+static void americanFlagSort(uint8_t* entries, uint64_t count, uint8_t entrySize, int digit)
+{
+    uint64_t counts[256], offset;
+    int b;
+
+    for( ; digit<INDEX_HASH_SIZE ; digit++)
+    {
+        if(count <= IN_PLACE_SORT_THRESHOLD)
+        {
+            insertionSort(entries, count, entrySize);
+            return;
+        }
+
+        countDigits(entries, count, entrySize, digit, counts);
+
+        // A byte shared by all the entries does not need a pass
+        if(counts[entries[digit]] != count)
+        {
+            break;
+        }
+    }
+
+    if(digit == INDEX_HASH_SIZE)
+    {
+        return;
+    }
+
+    partitionEntries(entries, entrySize, digit, counts);
+
+    for(b=0, offset=0 ; b<256 ; b++)
+    {
+        americanFlagSort(entries + offset * entrySize, counts[b], entrySize, digit + 1);
+        offset += counts[b];
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef SORTING_H
+#define SORTING_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "index.h"
+
+typedef enum {
+    SORT_MERGE,
+    SORT_RADIX,
+    SORT_IN_PLACE
+} SortAlgorithm;
+
+#define IN_PLACE_SORT_THRESHOLD 32
+
+int getSortAlgorithm(const char* name, SortAlgorithm* algorithm);
+int needsSortWork(SortAlgorithm algorithm);
+
+void sortIndexEntries(uint8_t* entries, uint8_t* work, uint64_t count, uint8_t entrySize, SortAlgorithm algorithm);
+void sortIndexEntriesParallel(uint8_t* entries, uint8_t* work, uint64_t count, uint8_t entrySize, SortAlgorithm algorithm,
+                              uint32_t threadsCount);
+
+#endif //SORTING_H
@@ -0,0 +1,521 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "table.h"
+
+#define LINEAR_SEARCH_THRESHOLD 8 // Windows this small are scanned, they span a couple of cache lines
+
+static const char* optionNames[] = {"--mmap", "--populate", "--hugepage", "--mlock", "--warm", "--binary-search",
+                                    "--btree", "--no-filter"};
+static const uint32_t optionFlags[] = {TABLE_MMAP, TABLE_POPULATE, TABLE_HUGEPAGE, TABLE_MLOCK, TABLE_WARM,
+                                       TABLE_BINARY_SEARCH, TABLE_BTREE, TABLE_NO_FILTER};
+
+// Returns 1 if option is not a table loading option
+int parseTableOption(const char* option, uint32_t* flags)
+{
+    uint32_t i;
+
+    for(i=0 ; i<sizeof(optionFlags)/sizeof(optionFlags[0]) ; i++)
+    {
+        if(strcmp(option, optionNames[i]) == 0)
+        {
+            *flags |= optionFlags[i];
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+const char* getTableOptionsUsage()
+{
+    return "[--mmap [--populate] [--warm]] [--hugepage] [--mlock] [--binary-search | --btree] [--no-filter]";
+}
+
+// Reads the header of the index, and opens its filter if it has an up to date one. Returns 1 if the file cannot be
+// opened, 2 if it is not an index and 3 if its hash function is unknown.
+int openIndexTable(const char* path, IndexTable* table)
+{
+    FILE* indexFile = fopen(path, "r");
+
+    memset(table, 0x00, sizeof(IndexTable));
+    table->fd = -1;
+    table->filter.fd = -1;
+
+    if(indexFile == NULL)
+    {
+        return 1;
+    }
+
+    if(readIndexHeader(indexFile, &table->header))
+    {
+        fclose(indexFile);
+        return 2;
+    }
+
+    table->fileSize = getFileSize(indexFile);
+    table->fd = dup(fileno(indexFile));
+
+    fclose(indexFile);
+
+    table->indexEntrySize = getIndexEntrySize(&table->header);
+    table->indexDataSize = table->header.dataBytes;
+    table->indexesCount = getIndexesCount(&table->header);
+
+    // A truncated file, such as an index still being copied, would be read past its end
+    if((table->header.wordlistOffset > table->fileSize)
+       || (table->fileSize < getIndexEntriesOffset(&table->header) + table->header.wordlistOffset))
+    {
+        return 2;
+    }
+
+    getHashInfos(table->header.hashName, &table->hashInfos);
+
+    if(table->fd == -1)
+    {
+        return 1;
+    }
+
+    openIndexFilter(path, table->indexesCount, &table->filter);
+
+    return (table->hashInfos.f == NULL) ? 3 : 0;
+}
+
+// Private memory the table will take once loaded with these flags. A mapped index is shared with the page cache, but
+// its search tree is not.
+uint64_t getIndexTableAllocation(IndexTable* table, uint32_t flags)
+{
+    uint64_t allocation = (flags & TABLE_MMAP) ? 0 : table->fileSize - sizeof(IndexHeader);
+
+    if(flags & TABLE_BTREE)
+    {
+        allocation += getSearchTreeSize(table->indexesCount);
+    }
+
+    return allocation;
+}
+
+static void* warmTable(void* arg)
+{
+    IndexTable* table = arg;
+    uint64_t pageSize = sysconf(_SC_PAGESIZE), offset;
+    volatile uint8_t sink = 0;
+
+    for(offset=0 ; (offset < table->memorySize) && !table->stopWarming ; offset+=pageSize)
+    {
+        sink += table->memory[offset];
+    }
+
+    (void) sink;
+
+    return NULL;
+}
+
+// Loads the entries and the wordlist, either read in private memory or mapped from the page cache where several
+// processes can share them.
+int loadIndexTable(IndexTable* table, uint32_t flags)
+{
+    uint64_t done = 0;
+    ssize_t readSize;
+    uint8_t* region;
+
+    table->flags = flags;
+
+    if(flags & TABLE_MMAP)
+    {
+        table->memorySize = table->fileSize;
+        table->memory = mmap(NULL, table->memorySize, PROT_READ, MAP_SHARED | ((flags & TABLE_POPULATE) ? MAP_POPULATE : 0),
+                             table->fd, 0);
+    }
+    else
+    {
+        table->memorySize = table->fileSize - sizeof(IndexHeader);
+        table->memory = mmap(NULL, table->memorySize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+
+    if(table->memory == MAP_FAILED)
+    {
+        table->memory = NULL;
+        return 1;
+    }
+
+    // Huge pages of a file mapping need a kernel with read-only THP for files, the private copy always gets them
+    if((flags & TABLE_HUGEPAGE) && (madvise(table->memory, table->memorySize, MADV_HUGEPAGE) == -1))
+    {
+        perror("Unable to use huge pages for the index");
+    }
+
+    if(flags & TABLE_MMAP)
+    {
+        region = table->memory + sizeof(IndexHeader);
+    }
+    else
+    {
+        while(done < table->memorySize)
+        {
+            readSize = pread(table->fd, table->memory + done, table->memorySize - done, sizeof(IndexHeader) + done);
+
+            if(readSize <= 0)
+            {
+                return 1;
+            }
+
+            done += readSize;
+        }
+
+        region = table->memory;
+    }
+
+    table->index = region + getIndexEntriesOffset(&table->header) - sizeof(IndexHeader);
+    table->wordlist = table->index + table->header.wordlistOffset;
+
+    // A directory left empty by an unsorted build is ignored
+    if(table->header.magic == INDEX_MAGIC_DIRECTORY)
+    {
+        table->directory = malloc(INDEX_DIRECTORY_SIZE);
+
+        if(table->directory == NULL)
+        {
+            return 1;
+        }
+
+        memcpy(table->directory, region, INDEX_DIRECTORY_SIZE);
+
+        if(!isIndexDirectoryValid(&table->header, table->directory))
+        {
+            free(table->directory);
+            table->directory = NULL;
+        }
+    }
+
+    // Building the tree reads a key every SEARCH_TREE_BLOCK_ENTRIES entries, so it faults the whole index in
+    if((flags & TABLE_BTREE) && buildSearchTree(&table->tree, table->index, table->indexesCount, table->indexEntrySize,
+                                                flags & TABLE_HUGEPAGE))
+    {
+        return 1;
+    }
+
+    if((flags & TABLE_MLOCK) && (mlock(table->memory, table->memorySize) == -1))
+    {
+        perror("Unable to lock the index in memory");
+    }
+
+    if(flags & TABLE_NO_FILTER)
+    {
+        closeIndexFilter(&table->filter);
+    }
+    else if((table->filter.fd != -1) && loadIndexFilter(&table->filter, flags & TABLE_MLOCK))
+    {
+        return 1;
+    }
+
+    if((flags & TABLE_MMAP) && (flags & TABLE_WARM))
+    {
+        table->warming = (pthread_create(&table->warmer, NULL, warmTable, table) == 0);
+    }
+
+    return 0;
+}
+
+void closeIndexTable(IndexTable* table)
+{
+    if(table->warming)
+    {
+        table->stopWarming = 1;
+        pthread_join(table->warmer, NULL);
+        table->warming = 0;
+    }
+
+    if(table->memory != NULL)
+    {
+        munmap(table->memory, table->memorySize);
+        table->memory = NULL;
+    }
+
+    free(table->directory);
+    table->directory = NULL;
+
+    freeSearchTree(&table->tree);
+    closeIndexFilter(&table->filter);
+
+    if(table->fd != -1)
+    {
+        close(table->fd);
+        table->fd = -1;
+    }
+}
+
+// Position of the first entry of [first, end) whose hash is not below the key, found by bisection
+static int64_t findFirstBinary(IndexTable* table, uint64_t key, int64_t first, int64_t end)
+{
+    int64_t l = first, u = end, m;
+
+    while(l < u)
+    {
+        m = l + (u - l) / 2;
+
+        if(getEntryKey(table->index + m * table->indexEntrySize) < key)
+        {
+            l = m + 1;
+        }
+        else
+        {
+            u = m;
+        }
+    }
+
+    return l;
+}
+
+// Position of the first entry of [first, end) whose hash is not below the key. The hashes are uniform, so the position is guessed
+// from the key value and a lookup usually touches 2 or 3 entries. Skewed windows fall back to bisection after as
+// many probes as log2(log2(n)) would need on uniform keys, which keeps the worst case logarithmic.
+static int64_t findFirstInterpolation(IndexTable* table, uint64_t key, int64_t first, int64_t end)
+{
+    uint8_t* index = table->index;
+    uint8_t indexEntrySize = table->indexEntrySize;
+    int64_t l = first, u = end - 1, m;
+    uint64_t lowKey, highKey;
+    uint32_t probes = 0, maxProbes;
+
+    if((u < l) || (getEntryKey(index + u * indexEntrySize) < key))
+    {
+        return end;
+    }
+
+    maxProbes = 2 + 2 * (64 - __builtin_clzll(64 - __builtin_clzll(end - first)));
+
+    // The first entry not below the key is in [l, u] and the entry u is not below the key
+    while(u - l > LINEAR_SEARCH_THRESHOLD)
+    {
+        lowKey = getEntryKey(index + l * indexEntrySize);
+
+        if(lowKey >= key)
+        {
+            return l;
+        }
+
+        if(probes++ < maxProbes)
+        {
+            highKey = getEntryKey(index + u * indexEntrySize);
+            m = l + (int64_t) (((unsigned __int128) (key - lowKey) * (uint64_t) (u - l)) / (highKey - lowKey));
+
+            // The guess must shrink the window
+            m = (m <= l) ? l + 1 : ((m >= u) ? u - 1 : m);
+        }
+        else
+        {
+            m = l + (u - l) / 2;
+        }
+
+        if(getEntryKey(index + m * indexEntrySize) < key)
+        {
+            l = m + 1;
+        }
+        else
+        {
+            u = m;
+        }
+    }
+
+    while(getEntryKey(index + l * indexEntrySize) < key)
+    {
+        l++;
+    }
+
+    return l;
+}
+
+// Entries [first, end) holding the first entry whose hash is not below the key, narrowed by the tree or the directory
+static void getSearchRange(IndexTable* table, uint64_t key, int64_t* first, int64_t* end)
+{
+    uint64_t sample;
+
+    *first = 0;
+    *end = table->indexesCount;
+
+    // The tree leaves a block of SEARCH_TREE_BLOCK_ENTRIES entries, which ends with the first sample not below the key
+    if(table->flags & TABLE_BTREE)
+    {
+        sample = searchTree(&table->tree, key);
+        *first = (sample == 0) ? 0 : (sample - 1) * SEARCH_TREE_BLOCK_ENTRIES;
+
+        if(sample * SEARCH_TREE_BLOCK_ENTRIES + 1 < (uint64_t) *end)
+        {
+            *end = sample * SEARCH_TREE_BLOCK_ENTRIES + 1;
+        }
+    }
+    // The directory bounds the search to the entries sharing the top bits of the hash
+    else if(table->directory != NULL)
+    {
+        *first = table->directory[key >> (64 - INDEX_DIRECTORY_BITS)];
+        *end = table->directory[(key >> (64 - INDEX_DIRECTORY_BITS)) + 1];
+    }
+}
+
+// Position of the first entry whose hash is not below the hash prefix, searched as the loading flags ask
+int64_t findFirstEntry(IndexTable* table, const uint8_t* hash)
+{
+    uint64_t key = getEntryKey(hash);
+    int64_t first, end;
+
+    getSearchRange(table, key, &first, &end);
+
+    return (table->flags & (TABLE_BINARY_SEARCH | TABLE_BTREE)) ? findFirstBinary(table, key, first, end)
+                                                                : findFirstInterpolation(table, key, first, end);
+}
+
+// Bisects a group of searches in lockstep. Each round compares the probes prefetched by the previous round and
+// prefetches the next ones, so the cache misses of the whole group are in flight together.
+static void findFirstEntries(IndexTable* table, const uint8_t* digests, uint32_t count, int64_t* first, int64_t* end)
+{
+    uint8_t* index = table->index;
+    uint8_t indexEntrySize = table->indexEntrySize, digestSize = table->hashInfos.digestSize;
+    uint64_t keys[LOOKUP_GROUP_SIZE];
+    uint32_t i, active;
+    int64_t m;
+
+    for(i=0 ; i<count ; i++)
+    {
+        keys[i] = getEntryKey(digests + i * digestSize);
+
+        if(table->directory != NULL)
+        {
+            __builtin_prefetch(&table->directory[keys[i] >> (64 - INDEX_DIRECTORY_BITS)]);
+        }
+    }
+
+    for(i=0 ; i<count ; i++)
+    {
+        getSearchRange(table, keys[i], &first[i], &end[i]);
+        __builtin_prefetch(index + (first[i] + (end[i] - first[i]) / 2) * indexEntrySize);
+    }
+
+    do
+    {
+        for(i=0, active=0 ; i<count ; i++)
+        {
+            if(first[i] >= end[i])
+            {
+                continue;
+            }
+
+            m = first[i] + (end[i] - first[i]) / 2;
+
+            if(getEntryKey(index + m * indexEntrySize) < keys[i])
+            {
+                first[i] = m + 1;
+            }
+            else
+            {
+                end[i] = m;
+            }
+
+            if(first[i] < end[i])
+            {
+                __builtin_prefetch(index + (first[i] + (end[i] - first[i]) / 2) * indexEntrySize);
+                active++;
+            }
+        }
+    } while(active > 0);
+}
+
+// Decodes the words of the entries with the prefix of hash from position m, until one of them has this hash. A missing
+// digest gets an empty out and LOOKUP_NOT_FOUND as length, to tell it from an empty word.
+void resolveEntry(IndexTable* table, uint8_t* digestTmp, const uint8_t* hash, int64_t m, uint8_t* out, size_t* outlen)
+{
+    uint8_t* index = table->index;
+    uint8_t indexEntrySize = table->indexEntrySize;
+
+    *out = '\0';
+    *outlen = LOOKUP_NOT_FOUND;
+
+    while((m < table->indexesCount) && (memcmp(index + m * indexEntrySize, hash, INDEX_HASH_SIZE) == 0))
+    {
+        readWord(index + m * indexEntrySize + INDEX_HASH_SIZE, table->wordlist, table->indexDataSize, out);
+        *outlen = strlen((char*) out);
+        table->hashInfos.f(out, *outlen, digestTmp);
+
+        if(memcmp(hash, digestTmp, table->hashInfos.digestSize) == 0)
+        {
+            return;
+        }
+
+        *out = '\0'; // Put a 0 again on the first output byte to know when a result is found or not.
+        *outlen = LOOKUP_NOT_FOUND;
+        m++;
+    }
+}
+
+// Looks for the word of a digest. out holds the NUL-terminated word and outlen its length, LOOKUP_NOT_FOUND if the
+// digest is not in the index.
+void lookup(IndexTable* table, uint8_t* digestTmp, uint8_t* hash, uint8_t* out, size_t* outlen)
+{
+    if((table->filter.blocks != NULL) && !mayContainKey(&table->filter, getEntryKey(hash)))
+    {
+        *out = '\0';
+        *outlen = LOOKUP_NOT_FOUND;
+        return;
+    }
+
+    resolveEntry(table, digestTmp, hash, findFirstEntry(table, hash), out, outlen);
+}
+
+// Looks for the words of count digests stored one after the other. The digests that the filter rejects are answered
+// at once, the others are searched by groups of LOOKUP_GROUP_SIZE, and the pointed words of a group are prefetched
+// before any of them is decoded.
+void lookupBatch(IndexTable* table, uint8_t* digestTmp, const uint8_t* digests, uint32_t count, uint8_t* const* outs,
+                 size_t* outlens)
+{
+    uint8_t groupDigests[LOOKUP_GROUP_SIZE * MAX_DIGEST_SIZE];
+    uint8_t* entry;
+    uint8_t indexEntrySize = table->indexEntrySize, digestSize = table->hashInfos.digestSize;
+    int64_t first[LOOKUP_GROUP_SIZE], end[LOOKUP_GROUP_SIZE];
+    uint32_t positions[LOOKUP_GROUP_SIZE];
+    uint32_t next = 0, i, groupCount;
+
+    while(next < count)
+    {
+        for(groupCount=0 ; (next < count) && (groupCount < LOOKUP_GROUP_SIZE) ; next++)
+        {
+            if(table->filter.blocks != NULL)
+            {
+                // The block of a later digest is on its way while this one is checked
+                if(next + LOOKUP_GROUP_SIZE < count)
+                {
+                    prefetchFilterKey(&table->filter, getEntryKey(digests + (next + LOOKUP_GROUP_SIZE) * digestSize));
+                }
+
+                if(!mayContainKey(&table->filter, getEntryKey(digests + next * digestSize)))
+                {
+                    *outs[next] = '\0';
+                    outlens[next] = LOOKUP_NOT_FOUND;
+                    continue;
+                }
+            }
+
+            memcpy(groupDigests + groupCount * digestSize, digests + next * digestSize, digestSize);
+            positions[groupCount++] = next;
+        }
+
+        findFirstEntries(table, groupDigests, groupCount, first, end);
+
+        for(i=0 ; i<groupCount ; i++)
+        {
+            entry = table->index + first[i] * indexEntrySize;
+
+            if((first[i] < table->indexesCount) && !(entry[indexEntrySize - 1] & INLINE_WORD_MASK)
+               && (memcmp(entry, groupDigests + i * digestSize, INDEX_HASH_SIZE) == 0))
+            {
+                __builtin_prefetch(table->wordlist + getPointerFromData(entry + INDEX_HASH_SIZE, table->indexDataSize));
+            }
+        }
+
+        for(i=0 ; i<groupCount ; i++)
+        {
+            resolveEntry(table, digestTmp, groupDigests + i * digestSize, first[i], outs[positions[i]],
+                         &outlens[positions[i]]);
+        }
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "index.h"
+#include "hash.h"
+#include "searchtree.h"
+#include "filter.h"
+
+// Loading options of an index table
+#define TABLE_MMAP 0x1 // Map the index file read-only instead of reading it in memory
+#define TABLE_POPULATE 0x2 // Fault the whole mapping in when it is created
+#define TABLE_HUGEPAGE 0x4 // Ask for transparent huge pages
+#define TABLE_MLOCK 0x8 // Lock the index in RAM
+#define TABLE_WARM 0x10 // Touch every page of the mapping from a background thread
+#define TABLE_BINARY_SEARCH 0x20 // Bisect instead of interpolating the position of the hashes
+#define TABLE_BTREE 0x40 // Search a static B+ tree of the hashes built at load time
+#define TABLE_NO_FILTER 0x80 // Ignore the filter of the index, every miss is searched
+
+#define LOOKUP_GROUP_SIZE 16 // Searches of a batch advanced together, enough misses in flight to cover the latency
+#define LOOKUP_NOT_FOUND ((size_t) -1) // Length of the result of a digest missing from the index
+
+// An index loaded for lookups, shared read-only by all its users
+typedef struct {
+    IndexHeader header;
+    HashInfos hashInfos;
+    uint8_t indexEntrySize;
+    uint8_t indexDataSize;
+    int64_t indexesCount;
+    uint32_t flags;
+    uint8_t* index;
+    uint8_t* wordlist;
+    uint64_t* directory;
+    SearchTree tree;
+    IndexFilter filter;
+    uint8_t* memory;
+    uint64_t memorySize;
+    uint64_t fileSize;
+    int fd;
+    int warming;
+    volatile int stopWarming;
+    pthread_t warmer;
+} IndexTable;
+
+int parseTableOption(const char* option, uint32_t* flags);
+const char* getTableOptionsUsage();
+
+int openIndexTable(const char* path, IndexTable* table);
+uint64_t getIndexTableAllocation(IndexTable* table, uint32_t flags);
+int loadIndexTable(IndexTable* table, uint32_t flags);
+void closeIndexTable(IndexTable* table);
+
+int64_t findFirstEntry(IndexTable* table, const uint8_t* hash);
+void resolveEntry(IndexTable* table, uint8_t* digestTmp, const uint8_t* hash, int64_t m, uint8_t* out, size_t* outlen);
+void lookup(IndexTable* table, uint8_t* digestTmp, uint8_t* hash, uint8_t* out, size_t* outlen);
+void lookupBatch(IndexTable* table, uint8_t* digestTmp, const uint8_t* digests, uint32_t count, uint8_t* const* outs,
+                 size_t* outlens);
+
+#endif //TABLE_H
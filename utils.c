@@ -1,4 +1,17 @@
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "utils.h"
+#include "defines.h"
+
+#define WORDLIST_BLOCK_SIZE (16 * MIB)
 
 uint64_t getFileSize(FILE* f)
 {
@@ -11,9 +24,234 @@ uint64_t getFileSize(FILE* f)
     return size;
 }
 
-int isNumeric(char* s)
+// Appends the content of in, from offset to its end, to out
+int copyFileTail(FILE* in, uint64_t offset, FILE* out)
+{
+    uint8_t* copyBuffer = malloc(MIB);
+    size_t readSize;
+    int error = 0;
+
+    if(copyBuffer == NULL)
+    {
+        return 1;
+    }
+
+    fseek(in, offset, SEEK_SET);
+
+    while(!error && ((readSize = fread(copyBuffer, 1, MIB, in)) != 0))
+    {
+        error = (fwrite(copyBuffer, readSize, 1, out) != 1);
+    }
+
+    free(copyBuffer);
+
+    return error;
+}
+
+// Returns the first '\r' or '\n' in [s, end), or NULL if there is none.
+static const char* findLineEnd(const char* s, const char* end)
+{
+#ifdef __SSE2__
+    const __m128i cr = _mm_set1_epi8('\r'), lf = _mm_set1_epi8('\n');
+    __m128i chunk;
+    int mask;
+
+    for( ; s + sizeof(__m128i) <= end ; s += sizeof(__m128i))
+    {
+        chunk = _mm_loadu_si128((const __m128i*) s);
+        mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, cr), _mm_cmpeq_epi8(chunk, lf)));
+
+        if(mask)
+        {
+            return s + __builtin_ctz(mask);
+        }
+    }
+#endif
+
+    for( ; s < end ; s++)
+    {
+        if((*s == '\r') || (*s == '\n'))
+        {
+            return s;
+        }
+    }
+
+    return NULL;
+}
+
+// Regular files are mapped, anything else (pipes, devices...) is streamed through a WORDLIST_BLOCK_SIZE buffer.
+int openWordlist(const char* path, WordlistReader* reader)
+{
+    struct stat st;
+
+    memset(reader, 0x00, sizeof(WordlistReader));
+    reader->fd = open(path, O_RDONLY);
+
+    if(reader->fd == -1)
+    {
+        return 1;
+    }
+
+    if((fstat(reader->fd, &st) == 0) && S_ISREG(st.st_mode))
+    {
+        reader->size = st.st_size;
+
+        if(reader->size == 0)
+        {
+            reader->mapped = 1;
+            reader->eof = 1;
+            return 0;
+        }
+
+        reader->data = mmap(NULL, reader->size, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+
+        if(reader->data != MAP_FAILED)
+        {
+            madvise(reader->data, reader->size, MADV_SEQUENTIAL);
+
+            reader->mapped = 1;
+            reader->eof = 1;
+            reader->length = reader->size;
+            return 0;
+        }
+    }
+
+    reader->data = malloc(WORDLIST_BLOCK_SIZE);
+
+    if(reader->data == NULL)
+    {
+        close(reader->fd);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Moves the unread bytes to the beginning of the buffer and fills the rest of it from the file.
+static void fillWordlist(WordlistReader* reader)
 {
-    for( ; *s ; s++)
+    size_t remaining = reader->length - reader->position;
+    ssize_t readSize;
+
+    memmove(reader->data, reader->data + reader->position, remaining);
+
+    reader->dataOffset += reader->position;
+    reader->position = 0;
+    reader->length = remaining;
+
+    while((reader->length < WORDLIST_BLOCK_SIZE) && !reader->eof)
+    {
+        readSize = read(reader->fd, reader->data + reader->length, WORDLIST_BLOCK_SIZE - reader->length);
+
+        if(readSize > 0)
+        {
+            reader->length += readSize;
+        }
+        else if((readSize == 0) || (errno != EINTR))
+        {
+            reader->eof = 1;
+        }
+    }
+}
+
+// A word ends at the first '\r' or '\n' of its line, the rest of the line is skipped. The returned word is not
+// NUL-terminated and stays valid until the next call (until closeWordlist if the wordlist is mapped).
+// Returns 1 if a word is read, 0 at the end of the wordlist and -1 if the line is too long.
+int nextWord(WordlistReader* reader, const char** word, size_t* length)
+{
+    const char* start, *end, *limit, *newline;
+
+    while(reader->skipLine)
+    {
+        newline = memchr(reader->data + reader->position, '\n', reader->length - reader->position);
+
+        if(newline != NULL)
+        {
+            reader->position = newline - reader->data + 1;
+            reader->skipLine = 0;
+        }
+        else if(reader->eof)
+        {
+            reader->position = reader->length;
+            reader->skipLine = 0;
+        }
+        else
+        {
+            reader->position = reader->length;
+            fillWordlist(reader);
+        }
+    }
+
+    while(1)
+    {
+        start = reader->data + reader->position;
+        limit = reader->data + reader->length;
+        end = findLineEnd(start, (limit - start > MAX_LINE_SIZE) ? start + MAX_LINE_SIZE : limit);
+
+        if((end != NULL) || (limit - start >= MAX_LINE_SIZE))
+        {
+            break;
+        }
+
+        if(reader->eof)
+        {
+            if(start == limit)
+            {
+                return 0;
+            }
+
+            // The last line has no line break
+            end = limit;
+            break;
+        }
+
+        fillWordlist(reader);
+    }
+
+    if((end == NULL) || (end - start >= MAX_LINE_SIZE - 1))
+    {
+        return -1;
+    }
+
+    *word = start;
+    *length = end - start;
+
+    reader->position = end - reader->data;
+
+    if(end != limit)
+    {
+        reader->position++;
+        reader->skipLine = (*end == '\r');
+    }
+
+    return 1;
+}
+
+uint64_t getWordlistOffset(WordlistReader* reader)
+{
+    return reader->dataOffset + reader->position;
+}
+
+void closeWordlist(WordlistReader* reader)
+{
+    if(reader->mapped)
+    {
+        if(reader->size != 0)
+        {
+            munmap(reader->data, reader->size);
+        }
+    }
+    else
+    {
+        free(reader->data);
+    }
+
+    close(reader->fd);
+}
+
+int isNumeric(const char* s, size_t n)
+{
+    for( ; n ; n--, s++)
     {
         if((*s < 0x30) || (*s > 0x39))
         {
@@ -24,9 +262,22 @@ int isNumeric(char* s)
     return 1;
 }
 
-int isAlphanumeric(char* s)
+int isHex(const char* s, size_t n)
+{
+    for( ; n ; n--, s++)
+    {
+        if(!(((*s >= 0x30) && (*s <= 0x39)) || ((*s >= 0x41) && (*s <= 0x46)) || ((*s >= 0x61) && (*s <= 0x66))))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int isAlphanumeric(const char* s, size_t n)
 {
-    for( ; *s ; s++)
+    for( ; n ; n--, s++)
     {
         if(!(((*s >= 0x30) && (*s <= 0x39)) || ((*s >= 0x41) && (*s <= 0x5A)) || ((*s >= 0x61) && (*s <= 0x7A))))
         {
@@ -37,9 +288,9 @@ int isAlphanumeric(char* s)
     return 1;
 }
 
-int isReducedASCII(char* s)
+int isReducedASCII(const char* s, size_t n)
 {
-    for( ; *s ; s++)
+    for( ; n ; n--, s++)
     {
         if(((uint8_t) *s) >= 0x7F)
         {
@@ -50,7 +301,7 @@ int isReducedASCII(char* s)
     return 1;
 }
 
-void compressNumeric(char* s, size_t n, uint8_t* out)
+void compressNumeric(const char* s, size_t n, uint8_t* out)
 {
     uint32_t i;
 
@@ -76,7 +327,7 @@ void compressNumeric(char* s, size_t n, uint8_t* out)
     }
 }
 
-void compressAlphanumeric(char* s, size_t n, uint8_t* out)
+void compressAlphanumeric(const char* s, size_t n, uint8_t* out)
 {
     uint32_t i, j;
     uint8_t b;
@@ -159,7 +410,7 @@ void compressAlphanumeric(char* s, size_t n, uint8_t* out)
     }
 }
 
-void compressReducedASCII(char* s, size_t n, uint8_t* out)
+void compressReducedASCII(const char* s, size_t n, uint8_t* out)
 {
     uint32_t i, j;
     uint8_t k, b;
@@ -314,6 +565,19 @@ void uncompressReducedASCII(uint8_t* c, uint8_t* out)
     }
 }
 
+// Writes the 2 * n lowercase hex digits of in, not NUL-terminated
+void hex(const uint8_t* in, size_t n, char* out)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+    size_t i;
+
+    for(i=0 ; i<n ; i++)
+    {
+        out[2 * i] = hexDigits[in[i] >> 4];
+        out[2 * i + 1] = hexDigits[in[i] & 0xF];
+    }
+}
+
 void unhex(char* hex, uint8_t* out, size_t n)
 {
     static const uint8_t unhexTable[256] = {
@@ -20,20 +20,40 @@
 #define ALPHANUMERIC_SYMBOL_BITS 6
 #define REDUCED_ASCII_SYMBOL_BITS 7
 
+typedef struct {
+    int fd;
+    int mapped;
+    int eof;
+    int skipLine;
+    char* data;
+    uint64_t size;
+    uint64_t dataOffset;
+    size_t position;
+    size_t length;
+} WordlistReader;
+
 uint64_t getFileSize(FILE* f);
+int copyFileTail(FILE* in, uint64_t offset, FILE* out);
+
+int openWordlist(const char* path, WordlistReader* reader);
+int nextWord(WordlistReader* reader, const char** word, size_t* length);
+uint64_t getWordlistOffset(WordlistReader* reader);
+void closeWordlist(WordlistReader* reader);
 
-int isAlphanumeric(char* s);
-int isReducedASCII(char* s);
-int isNumeric(char* s);
+int isAlphanumeric(const char* s, size_t n);
+int isReducedASCII(const char* s, size_t n);
+int isNumeric(const char* s, size_t n);
+int isHex(const char* s, size_t n);
 
-void compressNumeric(char* s, size_t n, uint8_t* out);
-void compressAlphanumeric(char* s, size_t n, uint8_t* out);
-void compressReducedASCII(char* s, size_t n, uint8_t* out);
+void compressNumeric(const char* s, size_t n, uint8_t* out);
+void compressAlphanumeric(const char* s, size_t n, uint8_t* out);
+void compressReducedASCII(const char* s, size_t n, uint8_t* out);
 
 void uncompressNumeric(uint8_t* c, uint8_t* out);
 void uncompressAlphanumeric(uint8_t* c, uint8_t* out);
 void uncompressReducedASCII(uint8_t* c, uint8_t* out);
 
+void hex(const uint8_t* in, size_t n, char* out);
 void unhex(char* hex, uint8_t* out, size_t n);
 
 #endif //UTILS_H